@@ -1,27 +1,116 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <time.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mpi.h>
+#ifdef USE_MPE
+#include <mpe.h>
+#endif
 #include "pilot.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2
+#include <immintrin.h>
+#endif
+
 #define SIZE_RECORD 61          //Length of a record
 #define SIZE_HEADER 145         //Lenght of a header
 #define SIZE_EOL 2              //Amount of EOL characters in each line
 #define LENGTH_COLL 32			//Characters representing collision level data
-#define COL_COUNT 22            //Amount of columns found in each record
-#define COL_CYEAR 1             //Collision year
-#define COL_MNTH 2              //Collision month
-#define COL_DAY 3               //Collision day
-#define COL_SEV 20               //Collision severity
-#define COL_VEHN 6				//Number of vehicles involved in collision
-#define COL_LOC 8               //Collision location
-#define COL_VYEAR 15            //Vehicle year involved in collision
-#define COL_SEX 17              //Gender of individual involved in collision
-#define COL_VID	13		        //Column of vehicle ID
+#define OFF_CYEAR 0             //Offset of collision year in a record
+#define OFF_MNTH 5              //Offset of collision month
+#define OFF_DAY 8               //Offset of collision day
+#define OFF_VEHN 15             //Offset of number of vehicles involved in collision
+#define OFF_LOC 21              //Offset of collision location
+#define OFF_VID 33              //Offset of vehicle ID
+#define OFF_VTYPE 36            //Offset of vehicle type
+#define OFF_VYEAR 39            //Offset of vehicle year involved in collision
+#define OFF_SEX 47              //Offset of gender of individual involved in collision
+#define OFF_SEV 55              //Offset of severity of injury to individual
 #define FATA 0
 #define COLL 1
+#define READ_STDIO 0            //Read partitions line by line through stdio
+#define READ_MMAP 1             //Map partitions into memory and parse in place
+#define REC_PER_COL 2           //Expected records per collision when reserving space
+#define CHUNK_RECORDS 4096      //Records read at a time by the stdio reader
+#define BATCH_RECORDS 8         //Records decoded at a time by the vector decoder
+#define BINARY_MAGIC "BANGCOL"  //Identifies a converted columnar file
+#define BINARY_VERSION 1        //Layout version of converted files
+#define BINARY_ORDER 0x01020304 //Reads differently on a machine of other byte order
+#define BINARY_ARRAYS 10        //Arrays stored in a converted file
+#define ALIGN8(size) (((size)+7) & ~(size_t)7)
+#define CUBE_MONTHS 13           //Months 1-12 and one for unspecified months
+#define CUBE_LOCS 14             //Locations 0-12 and one for any other code
+#define CUBE_GENDERS 3           //Men, women and anyone else
+#define CUBE_VEHS 100            //Number of vehicles in a collision
+#define CUBE_QUERIES (1<<1 | 1<<2 | 1<<3 | 1<<5)  //Queries answered from the cube
+#define PACKED_CUBE (2+5*CUBE_VEHS)  //Integers in a packed cube before its years
+#define PACKED_AGGREGATES (2+2+5+3+13+2)  //Integers in packed aggregates before the monthly tally
+#define INDEX_MAGIC "BANGIDX"   //Identifies a collision index sidecar file
+#define INDEX_VERSION 1         //Layout version of collision index files
+#define INDEX_SUFFIX ".idx"     //Appended to the data file name to name its index
+#define GROUP_FILTERS 4         //Most filter predicates in a group query
+#define GROUP_KEYS 3            //Most columns a group query groups by
+#define GROUP_BLOCK 256         //Rows a group query evaluates at a time
+#define GROUP_CELLS (1<<20)     //Most cells in the table of a group query
+#define GROUP_INTS ((int)(sizeof(GroupQuery)/sizeof(int)))  //Integers in a packed group query
+#define COL_YEAR 0              //Columns a group query can filter, group or aggregate
+#define COL_MONTH 1
+#define COL_DAY 2
+#define COL_LOCATION 3
+#define COL_GENDER 4
+#define COL_VEHYEAR 5
+#define COL_VEHNUM 6
+#define COL_VEHID 7
+#define COL_DEATH 8
+#define COLUMNS 9
+#define OP_EQ 0                 //Comparisons of a filter predicate
+#define OP_NE 1
+#define OP_LT 2
+#define OP_LE 3
+#define OP_GT 4
+#define OP_GE 5
+#define AGG_COUNT 0             //Aggregate functions of a group query
+#define AGG_SUM 1
+#define AGG_MIN 2
+#define AGG_MAX 3
+#define LEVEL_RECORDS 0         //Group query looks at every record
+#define LEVEL_COLLISIONS 1      //Group query looks at the first record of each collision
+#define BUILTIN_CELLS (26+1)    //Cells in the largest built-in group query of fixed size
+#define PROF_OPEN 0             //Phases timed when profiling: opening and sizing the file
+#define PROF_POSITIONS 1        //Finding where partitions start
+#define PROF_PARSE 2            //Reading and parsing partitions
+#define PROF_QUERIES 3          //One pass answering every requested query and the cube
+#define PROF_WRITE 4            //PI_Write calls
+#define PROF_READ 5             //PI_Read calls
+#define PROF_SELECT 6           //PI_Select calls
+#define PROF_BROADCAST 7        //PI_Broadcast calls
+#define PROF_PHASES 8           //Number of phases timed
+#define ARENA_ALIGN 64          //Alignment of every arena allocation, one cache line
+#define ARENA_MIN 4096          //Smallest block an arena allocates
+#define ALIGN_ARENA(size) (((size)+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))
+
+/*Number of the record found at a position of a csv file*/
+#define RECORD_AT(pos) (((pos)-SIZE_HEADER-SIZE_EOL)/(SIZE_RECORD+SIZE_EOL))
+
+/*Index of the collisions (fatal 0) or deaths (fatal 1) in a month
+of the monthly tally, counting years from the first in the tally*/
+#define TALLY(year,month,fatal) ((((year)*12)+(month))*2+(fatal))
+#define CUBE_COLL(year,month,loc) ((((year)*CUBE_MONTHS)+(month))*CUBE_LOCS+(loc))
+#define CUBE_DEATHS(year,month,gender) ((((year)*CUBE_MONTHS)+(month))*CUBE_GENDERS+(gender))
+
+/*Runs a statement, timing it as one of the phases when profiling*/
+#define PROFILE(phase,statement) do { double profileStart = profStart(phase); statement; profEnd(phase, profileStart); } while (0)
+
+/*Whether the person in record i of a dataset died*/
+#define DIED(dataset,i) (((dataset)->death[(i)>>3] >> ((i)&7)) & 1)
 
 typedef struct Date Date;
 typedef struct Date {
@@ -41,12 +130,37 @@ typedef struct Record {
 	bool death;                 //Whether the person involved in the collision died
 } Record;
 
+typedef struct Arena Arena;
+typedef struct Arena {
+	char *base;                 //Block allocations are carved from
+	size_t size;                //Bytes in the block
+	size_t used;                //Bytes of the block handed out
+	Arena *next;                //Block filled before this one, NULL for the first
+} Arena;
+
 typedef struct Dataset Dataset;
 typedef struct Dataset {
 	int colNum;                 //Number of collisions found in dataset
 	int recNum;                 //Number of records found in dataset
+	int colCap;                 //Number of collision indexes memory is reserved for
+	int recCap;                 //Number of records memory is reserved for
 	int *collisionIndex;        //Array storing indexes of each collsion
-	Record **records;           //Array of records addresses
+	short *year;                //Year each collision occured
+	signed char *month;         //Month each collision occured
+	signed char *day;           //Day each collision occured
+	signed char *location;      //Code of each accident location
+	char *gender;               //Gender of each individual involved
+	short *vehYear;             //Year of each vehicle involved
+	signed char *vehNum;        //Number of vehicles involved in each collision
+	signed char *vehID;         //Id of each vehicle involved
+	unsigned char *death;       //Bitset of which individuals died
+	int minYear;                //Earliest known year of a record, INT_MAX if none
+	int maxYear;                //Latest known year of a record, 0 if none
+	int firstRecord;            //Record number in the file of the first record
+	int mapNum;                 //Number of ranges of a converted file the dataset maps
+	void *maps[BINARY_ARRAYS];  //Start of each mapped range, unmapped with the dataset
+	size_t mapSizes[BINARY_ARRAYS];  //Length of each mapped range
+	Arena *arena;               //Memory of the dataset and its columns
 } Dataset;
 
 
@@ -54,14 +168,16 @@ typedef struct WorstMonth WorstMonth;
 typedef struct WorstMonth {
 	Date total;
 	Date totalF;
-	Date fatal[14];
-	Date nonFatal[14];
+	int yearNum;                //Number of years below
+	Date *fatal;                //Worst month for deaths each year
+	Date *nonFatal;             //Worst month for collisions each year
 }WorstMonth;
 
 typedef struct MostVehicles MostVehicles;
 typedef struct MostVehicles {
 	Date date;
 	int total;
+	int record;                 //Record number in the file of the collision, ties go to the earliest
 }MostVehicles;
 
 typedef struct NewWreckedCars{
@@ -70,6 +186,160 @@ typedef struct NewWreckedCars{
 	int vehicleAgeTotal;
 }NewWreckedCars;
 
+typedef struct BinaryHeader BinaryHeader;
+typedef struct BinaryHeader {
+	char magic[8];              //BINARY_MAGIC
+	int version;                //BINARY_VERSION of the writer
+	int byteOrder;              //BINARY_ORDER of the writer
+	int recNum;                 //Number of records in the file
+	int colNum;                 //Number of collisions in the file
+	int splitNum;               //Number of worker split points after the header
+	int reserved;               //Keeps the header a multiple of 8 bytes
+}BinaryHeader;
+
+typedef struct IndexHeader IndexHeader;
+typedef struct IndexHeader {
+	char magic[8];              //INDEX_MAGIC
+	int version;                //INDEX_VERSION of the writer
+	int colNum;                 //Number of collision starts after the header
+	long size;                  //Size of the data file the index was built from
+	long mtime;                 //Modification time of the data file
+}IndexHeader;
+
+typedef struct CollisionIndex CollisionIndex;
+typedef struct CollisionIndex {
+	IndexHeader header;         //Header as stored in the sidecar file
+	int *starts;                //Record number each collision starts at
+}CollisionIndex;
+
+typedef struct Cube Cube;
+typedef struct Cube {
+	int firstYear;                                      //First year given its own slot
+	int yearNum;                                        //Number of years given their own slot, one more holds any other year
+	int *coll;                                          //Collisions by year, month and location, indexed with CUBE_COLL
+	int *deaths;                                        //Deaths by year, month and gender, indexed with CUBE_DEATHS
+	int vehCount[CUBE_VEHS];                            //Collisions by number of vehicles
+	Date vehFirst[CUBE_VEHS];                           //First collision with each number of vehicles
+	int vehRecord[CUBE_VEHS];                           //Record number in the file of each of those collisions
+}Cube;
+
+typedef struct Profile Profile;
+typedef struct Profile {
+	double seconds[PROF_PHASES];     //Wall time spent in each phase, summed over threads
+	long calls[PROF_PHASES];         //Times each phase ran, messages for the PI_ calls
+	long bytes;                      //Bytes of the file read
+	long records;                    //Records parsed
+}Profile;
+
+typedef struct GroupQuery GroupQuery;
+typedef struct GroupQuery {
+	int level;                  //LEVEL_RECORDS or LEVEL_COLLISIONS
+	int filterNum;              //Number of filter predicates, all of which must hold
+	int filterCol[GROUP_FILTERS];    //Column each predicate compares
+	int filterOp[GROUP_FILTERS];     //Comparison each predicate makes
+	int filterValue[GROUP_FILTERS];  //Value each predicate compares to
+	int groupNum;               //Number of columns grouped by
+	int groupCol[GROUP_KEYS];   //Columns grouped by, the first varying slowest
+	int groupMin[GROUP_KEYS];   //Smallest value of each column given its own group
+	int groupSpan[GROUP_KEYS];  //Number of values of each column given their own group
+	int func;                   //Aggregate function applied in each group
+	int column;                 //Column aggregated, unused for AGG_COUNT
+}GroupQuery;
+
+typedef struct GroupRun GroupRun;
+typedef struct GroupRun {
+	const GroupQuery *query;    //Group query evaluated in the pass
+	long long *cells;           //Table the query adds to
+}GroupRun;
+
+typedef struct GroupBlock GroupBlock;
+typedef struct GroupBlock {
+	const int *rows;            //Rows of the block
+	int count;                  //Number of rows
+	unsigned loaded;            //Bit of each column already loaded
+	int values[COLUMNS][GROUP_BLOCK]; //Values of each loaded column
+}GroupBlock;
+
+typedef struct Aggregates Aggregates;
+typedef struct ThreadJob ThreadJob;
+typedef struct Aggregates {
+	int queries;                //Bitmask of the queries being aggregated
+	int recNum;                 //Number of records aggregated
+	int colNum;                 //Number of collisions aggregated
+	int firstYear;              //First year of the monthly tally
+	int yearNum;                //Number of years in the monthly tally
+	int *tally;                 //Collisions and fatalities each month, indexed with TALLY (Query 1)
+	long long *monthCells;      //Group tables of collisions and deaths the tally is counted in
+	int killed[2];              //Men and women killed (Query 2)
+	MostVehicles mostVeh;       //Collision with the most vehicles (Query 3)
+	NewWreckedCars wrecks;      //New and total vehicles wrecked (Query 4)
+	int locs[13];               //Collisions at each location (Query 5)
+	Cube *cube;                 //Data cube built in the same pass, NULL if not used
+	int adhocNum;               //Number of ad-hoc group queries aggregated
+	GroupQuery *adhoc;          //Ad-hoc group queries, shared with the caller
+	long long **cells;          //Table of each ad-hoc group query, wide enough for sums
+	Arena *arena;               //Memory of the aggregates except the cube
+}Aggregates;
+
+typedef struct ThreadJob {
+	pthread_t thread;           //Thread running the job
+	char *fileName;             //File the partition is read from
+	long startPos;              //Position of the partition in the file
+	long readLength;            //Length of the partition
+	Aggregates *agg;            //Aggregates of the partition, NULL to only load it
+	Dataset *dataset;           //Partition loaded when there are no aggregates
+	bool read;                  //True once the partition was read
+}ThreadJob;
+
+int readMode = READ_MMAP;       //Reader used to load partitions of the file
+bool streamMode = false;        //Aggregate partitions without storing them
+BinaryHeader *binary = NULL;    //Header of the input file if it was converted, NULL for csv
+bool useIndex = false;          //Partition with a collision index sidecar file
+CollisionIndex *sidecar = NULL; //Collision index of the input file, NULL if not used
+int threadNum = 1;              //Threads each process splits its partition between
+int chunksPerWorker = 0;        //Chunks per worker handed out on demand, 0 for fixed partitions
+bool treeReduce = false;        //Workers combine their aggregates in a tree before the master
+bool collectiveRead = false;    //Ranks read their partitions with collective MPI-IO reads
+bool serveMode = false;         //Keep partitions loaded and answer queries read from stdin
+bool useCube = false;           //Build a data cube at load time and answer from it
+bool benchMode = false;         //Print the throughput of each phase and of the whole run
+bool profileMode = false;       //Time each phase and count bytes, records and messages
+Profile profile;                //Timings and counts of this process
+bool verifyMode = false;        //Check answers against a serial pass over the whole file
+FILE *answerOut = NULL;         //Where answers are printed, a buffer while verifying
+char *answerText = NULL;        //Answers buffered while verifying
+size_t answerSize = 0;          //Length of the buffered answers
+pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;  //Serializes profile updates from threads
+#ifdef USE_MPE
+int profileEvents[PROF_PHASES][2];  //MPE events starting and ending each phase
+#endif
+Aggregates *cubeResults = NULL; //Answers taken from the merged cube on the master
+
+/*Names of the phases in profile reports*/
+static const char *phaseNames[PROF_PHASES] = {"open","positions","parse","queries","write","read",
+	"select","broadcast"};
+
+/*Names of the columns a group query refers to, the smallest value
+of each and how many values follow it. Values outside of that
+range are counted in one extra group*/
+static const char *columnNames[COLUMNS] = {"year","month","day","location","gender","vehyear","vehnum","vehid","death"};
+static const int columnMin[COLUMNS] = {1999, 1, 1, 0, 'A', 1900, 0, 0, 0};
+static const int columnSpan[COLUMNS] = {14, 12, 7, 13, 26, 121, 100, 100, 2};
+
+/*Queries 1, 2 and 5 are answered by group queries, the years of
+query 1 are set to those of the tally before each use*/
+static const GroupQuery monthQuery = {LEVEL_COLLISIONS, 2, {COL_MONTH,COL_YEAR}, {OP_GT,OP_GT}, {0,0},
+	2, {COL_YEAR,COL_MONTH}, {0,1}, {0,12}, AGG_COUNT, 0};
+static const GroupQuery monthDeathQuery = {LEVEL_RECORDS, 3, {COL_DEATH,COL_MONTH,COL_YEAR}, {OP_EQ,OP_GT,OP_GT}, {1,0,0},
+	2, {COL_YEAR,COL_MONTH}, {0,1}, {0,12}, AGG_COUNT, 0};
+static const GroupQuery killedQuery = {LEVEL_RECORDS, 1, {COL_DEATH}, {OP_EQ}, {1},
+	1, {COL_GENDER}, {'A'}, {26}, AGG_COUNT, 0};
+static const GroupQuery locationQuery = {LEVEL_COLLISIONS, 0, {0}, {0}, {0},
+	1, {COL_LOCATION}, {0}, {13}, AGG_COUNT, 0};
+
+/*Decoder used for blocks of records, chosen from the CPU features in main*/
+static void (*decodeRecords)(Dataset *dataset, const char *records, int count);
+
 /******************HELPER FUNCTION DOCUMENTATION*********************/
 /*********************************************************************
  * FUNCTION NAME: partDataset
@@ -77,29 +347,168 @@ typedef struct NewWreckedCars{
  *          specified partition of the file.
  * ARGUMENTS: . File to be read from.
  *            . Position of the file to start reading from.
- *            . How many records to read.
+ *            . How many bytes to read.
+ * RETURNS: Address of Dataset containing all records found in the 
+ *          portion provided.
+ *********************************************************************/
+static Dataset *partDataset(FILE *file, long startPos, long readLength);
+
+/*********************************************************************
+ * FUNCTION NAME: mapDataset
+ * PURPOSE: Stores record data and collision indexes from a 
+ *          specified partition of the file by mapping only that
+ *          partition into memory and parsing it in place.
+ * ARGUMENTS: . Descriptor of the file to be mapped.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read.
+ * RETURNS: Address of Dataset containing all records found in the 
+ *          portion provided, NULL if the partition could not be
+ *          mapped.
+ *********************************************************************/
+static Dataset *mapDataset(int fd, long startPos, long readLength);
+
+/*********************************************************************
+ * FUNCTION NAME: bufferDataset
+ * PURPOSE: Stores record data and collision indexes from records
+ *          already present in memory.
+ * ARGUMENTS: . Address of the first record.
+ *            . Position of the file the buffer was read from.
+ *            . How many bytes of records are present.
+ * RETURNS: Address of Dataset containing all records found in the 
+ *          buffer provided.
+ *********************************************************************/
+static Dataset *bufferDataset(const char *buffer, long startPos, long readLength);
+
+/*********************************************************************
+ * FUNCTION NAME: loadDataset
+ * PURPOSE: Stores a partition of the file using the reader selected
+ *          at runtime, falling back to stdio if mapping fails.
+ * ARGUMENTS: . File to be read from.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read.
  * RETURNS: Address of Dataset containing all records found in the 
  *          portion provided.
  *********************************************************************/
-static Dataset *partDataset(FILE *file, int startPos, int readCount);
+static Dataset *loadDataset(FILE *file, long startPos, long readLength);
+
+/*********************************************************************
+ * FUNCTION NAME: addBlock
+ * PURPOSE: Adds a block of consecutive records to the dataset and
+ *          indexes the collisions that start in it, using the 
+ *          collision index sidecar when one is loaded.
+ * ARGUMENTS: . Dataset to add to.
+ *            . Address of the first record of the block.
+ *            . Number of records in the block.
+ *            . Record preceding the block, NULL if the block starts
+ *              the partition.
+ *            . Number of the first record of the block in the file.
+ *********************************************************************/
+static void addBlock(Dataset *dataset, const char *block, int count, const char *prevLine, int firstRecord);
+
+/*********************************************************************
+ * FUNCTION NAME: indexName
+ * PURPOSE: Gets the name of the collision index sidecar of a file.
+ * ARGUMENTS: . Name of the data file.
+ * RETURNS: Newly allocated name of the sidecar file.
+ *********************************************************************/
+static char *indexName(char *fileName);
+
+/*********************************************************************
+ * FUNCTION NAME: openIndex
+ * PURPOSE: Reads the collision index sidecar of a file if it was 
+ *          built from the file as it is now.
+ * ARGUMENTS: . Name of the data file.
+ * RETURNS: Address of the collision index, NULL if there is no 
+ *          sidecar or its size or modification time do not match.
+ *********************************************************************/
+static CollisionIndex *openIndex(char *fileName);
+
+/*********************************************************************
+ * FUNCTION NAME: buildIndex
+ * PURPOSE: Finds the start of every collision in a file and saves
+ *          them to its sidecar so later runs can skip the search.
+ * ARGUMENTS: . File to index.
+ *            . Name of the file.
+ * RETURNS: Address of the collision index.
+ *********************************************************************/
+static CollisionIndex *buildIndex(FILE *file, char *fileName);
+
+/*********************************************************************
+ * FUNCTION NAME: indexPositions
+ * PURPOSE: Gets the file position each worker should start at, 
+ *          giving each worker the same number of collisions.
+ * ARGUMENTS: . Number of workers performing the job.
+ * RETURNS: Integer array of size workerCount containing the indexes 
+ *          for each worker.
+ *********************************************************************/
+static long *indexPositions(int workerCount);
+
+/*********************************************************************
+ * FUNCTION NAME: decodeScalar
+ * PURPOSE: Adds the fields of consecutive records to the columns of
+ *          the dataset one record at a time.
+ * ARGUMENTS: . Dataset to add to.
+ *            . Address of the first record.
+ *            . Number of records to decode.
+ *********************************************************************/
+static void decodeScalar(Dataset *dataset, const char *records, int count);
+
+#ifdef HAVE_AVX2
+/*********************************************************************
+ * FUNCTION NAME: decodeAvx2
+ * PURPOSE: Adds the fields of consecutive records to the columns of
+ *          the dataset, decoding BATCH_RECORDS records at once with 
+ *          AVX2 gathers. Space for the records must be reserved.
+ * ARGUMENTS: . Dataset to add to.
+ *            . Address of the first record.
+ *            . Number of records to decode.
+ *********************************************************************/
+static void decodeAvx2(Dataset *dataset, const char *records, int count);
+#endif
 
 /*********************************************************************
  * FUNCTION NAME: getRecord
  * PURPOSE: Stores record data from a line retrieved from data file.
  * ARGUMENTS: . Line of text from data file.
- * RETURNS: Record containing parsed data.
+ *            . Record to store the parsed data in.
+ *********************************************************************/
+static void getRecord(const char *line, Record *record);
+
+/*********************************************************************
+ * FUNCTION NAME: fieldValue
+ * PURPOSE: Converts the leading digits of a fixed width field to an
+ *          integer, the same way strtol would.
+ * ARGUMENTS: . Address of the first character of the field.
+ *            . Width of the field in characters.
+ * RETURNS: Integer value of the field, 0 if it does not start with
+ *          a digit.
  *********************************************************************/
-static Record *getRecord(char *line);
+static inline int fieldValue(const char *field, int width);
 
 /*********************************************************************
- * FUNCTION NAME: sameCol
- * PURPOSE: Checks if two records are part of the same collion.
+ * FUNCTION NAME: diffCol
+ * PURPOSE: Checks if two neighbouring records are part of different
+ *          collisions, comparing fields as fixed width integers 
+ *          without branching. Safe to call from several threads.
  * ARGUMENTS: . Record being compared.
- *            . Record being compared.
- * RETURNS: True if the records are part of the same collision,
+ *            . Record following it.
+ * RETURNS: True if the second record starts a new collision,
  *          false otherwise.
  *********************************************************************/
-static bool diffCol(char *rec1, char *rec2);
+static inline bool diffCol(const char *rec1, const char *rec2);
+
+/*********************************************************************
+ * FUNCTION NAME: markBoundaries
+ * PURPOSE: Finds which records of a block start a collision in one
+ *          pass over the block.
+ * ARGUMENTS: . Address of the first record of the block.
+ *            . Number of records in the block.
+ *            . Record preceding the block, NULL if the first record
+ *              always starts a collision.
+ *            . Bitmap of (count+63)/64 words to fill, bit i is set 
+ *              when record i starts a collision.
+ *********************************************************************/
+static void markBoundaries(const char *block, int count, const char *prevLine, uint64_t *bounds);
 
 /*********************************************************************
  * FUNCTION NAME: fileSize
@@ -107,7 +516,7 @@ static bool diffCol(char *rec1, char *rec2);
  * ARGUMENTS: . File to find size of.
  * RETURNS: Integer containg size of file in bytes.
  *********************************************************************/
-static int fileSize(FILE *file);
+static long fileSize(FILE *file);
 
 /*********************************************************************
  * FUNCTION NAME: countRecords
@@ -115,7 +524,7 @@ static int fileSize(FILE *file);
  * ARGUMENTS: . File which contains the records.
  * RETURNS: Integer containing the number of records.
  *********************************************************************/
-static int countRecords(FILE *file);
+static long countRecords(FILE *file);
 
 /*********************************************************************
  * FUNCTION NAME: startPositions
@@ -126,14 +535,7 @@ static int countRecords(FILE *file);
  * RETURNS: Integer array of size workerCount containg the indexes 
  *          for each worker.
  *********************************************************************/
-static int *startPositions(FILE *file, int workerCount);
-
-/*********************************************************************
- * FUNCTION NAME: createRecord
- * PURPOSE: Allocates memory to and initializes the record.
- * ARGUMENTS: . Address of the pointer to the address of the record.
- *********************************************************************/
-static void createRecord(Record **record);
+static long *startPositions(FILE *file, int workerCount);
 
 /*********************************************************************
  * FUNCTION NAME: printRecord
@@ -162,7 +564,8 @@ static int colCount(Dataset *dataset);
 
 /*********************************************************************
  * FUNCTION NAME: addRecord
- * PURPOSE: Add record to the dataset data structure.
+ * PURPOSE: Add the fields of a record to the columns of the 
+ *          dataset data structure.
  * ARGUMENTS: . Dataset to add to.
  *            . Record being added.
  *********************************************************************/
@@ -177,616 +580,3278 @@ static void addRecord(Dataset *dataset, Record *record);
 static void addIndex(Dataset *dataset, int index);
 
 /*********************************************************************
- * FUNCTION NAME: createDataset
- * PURPOSE: Allocate memory and initialize dataset.
- * ARGUMENTS: . Address of the pointer to the dataset.
+ * FUNCTION NAME: createAggregates
+ * PURPOSE: Allocate memory and initialize the aggregates of a set 
+ *          of queries.
+ * ARGUMENTS: . Address of the pointer to the aggregates.
+ *            . Bitmask of the queries to aggregate.
  *********************************************************************/
-static void createDataset(Dataset **dataset);
-/*********************************************************************/
-int count=0;
-static bool diffCol(char *rec1, char *rec2){
-	int i;
-	char vtype[2][3],vyear[2][5],vid[2][3];
-	bool caseOne,caseTwo,caseThree, yearOrTypeChange;	
-
-	/*Store vehicle type*/
-	vtype[0][0] = rec1[36];
-	vtype[0][1] = rec1[37];
-	vtype[0][2] = '\0';
-	vtype[1][0] = rec2[36];
-	vtype[1][1] = rec2[37];
-	vtype[1][2] = '\0';
-
-	/*Store vehicle id*/
-	vid[0][0] = rec1[33];
-	vid[0][1] = rec1[34];
-	vid[0][2] = '\0';
-	vid[1][0] = rec2[33];
-	vid[1][1] = rec2[34];
-	vid[1][2] = '\0';
-
-	/*Store vehicle year*/
-	for (i=0;i<4;i++){
-		vyear[0][i] = rec1[39+i];
-	}
-	
-	for (i=0;i<4;i++){
-		vyear[1][i] = rec2[39+i];
-	}
-	vyear[0][4] = '\0';
-	vyear[1][4] = '\0';
-	
-	caseOne = !strncmp(rec1,rec2,LENGTH_COLL);	//coll level information same
-	caseTwo = (strcmp(vid[0],"01") != 0) && (strcmp(vid[1],"01") == 0);		//vehicle id changed to 1
-	yearOrTypeChange = ( (strcmp(vyear[0],vyear[1]) != 0) || (strcmp(vtype[0],vtype[1]) != 0) );
-	caseThree = (strcmp(vid[0],"01") == 0) && (strcmp(vid[1],"01") == 0) && yearOrTypeChange;	//Vehicle type or vehicle year changed
-
-	/*if (caseOne && caseTwo && !caseThree){
-		count++;
-		printf("count:%d, vtype[0]:%s,vtype[1]:%s,vid[0]:%s,vid[1]:%s,vyear:%s,vyear:%s\n"
-			,count,vtype[0],vtype[1],vid[0],vid[1],vyear[0],vyear[1]);
-	}*/
-	if ((caseOne==false)||(caseTwo==true)||(caseThree==true)){count++;}
-	return ((caseOne==false) || (caseTwo==true) || (caseThree==true));
+static void createAggregates(Aggregates **agg, int queries);
 
-}	
+/*********************************************************************
+ * FUNCTION NAME: queryMask
+ * PURPOSE: Gets the set of queries requested.
+ * ARGUMENTS: . Array of query numbers.
+ *            . Number of queries in the array.
+ * RETURNS: Bitmask with bit n set if query n was requested.
+ *********************************************************************/
+static int queryMask(int *queries, int queryCount);
 
-static int recCount(Dataset *dataset){
-	return dataset->recNum;
-}
+/*********************************************************************
+ * FUNCTION NAME: foldCollisions
+ * PURPOSE: Adds a range of collisions of the dataset to the 
+ *          aggregates of every requested query and ad-hoc group
+ *          query in one pass over blocks of its records.
+ * ARGUMENTS: . Dataset containing the collisions.
+ *            . Index of the first collision to add.
+ *            . Index after the last collision to add.
+ *            . Aggregates to add the collisions to.
+ *********************************************************************/
+static void foldCollisions(Dataset *dataset, int from, int to, Aggregates *agg);
 
-static int colCount(Dataset *dataset){
-	return dataset->colNum;
-}
+/*********************************************************************
+ * FUNCTION NAME: groupCells
+ * PURPOSE: Finds the size of the table of a group query.
+ * ARGUMENTS: . Group query.
+ * RETURNS: Number of cells, one for each combination of groups.
+ *********************************************************************/
+static int groupCells(const GroupQuery *query);
 
-static int fileSize(FILE *file){
-	int size;
+/*********************************************************************
+ * FUNCTION NAME: clearCells
+ * PURPOSE: Sets every cell of a group query table to the identity of
+ *          its aggregate function.
+ * ARGUMENTS: . Group query.
+ *            . Table of the group query.
+ *********************************************************************/
+static void clearCells(const GroupQuery *query, long long *cells);
 
-	fseek(file,0,SEEK_END);
-	size = ftell(file);
-	rewind(file);
+/*********************************************************************
+ * FUNCTION NAME: mergeCells
+ * PURPOSE: Combines the table of a group query from another part of
+ *          the file into a table.
+ * ARGUMENTS: . Group query.
+ *            . Table to merge into.
+ *            . Table to merge.
+ *********************************************************************/
+static void mergeCells(const GroupQuery *query, long long *cells, const long long *next);
 
-	return size;
-}
+/*********************************************************************
+ * FUNCTION NAME: loadColumn
+ * PURPOSE: Copies a column of some rows of the dataset into a block
+ *          of integers.
+ * ARGUMENTS: . Dataset containing the rows.
+ *            . Column to copy.
+ *            . Rows to copy.
+ *            . Number of rows.
+ *            . Block the values are copied to.
+ *********************************************************************/
+static void loadColumn(Dataset *dataset, int column, const int *rows, int count, int *values);
 
-static void printRecord(Record record){
-	printf("RECORD INFO - Year:%d\tMonth:%d\tDay:%d\tGender:%c\tVehicle Year:%d\t"
-		,record.date.year,record.date.month,record.date.day,record.gender,record.vehYear);
+/*********************************************************************
+ * FUNCTION NAME: filterBlock
+ * PURPOSE: Clears the flag of each value of a block that fails a
+ *          filter predicate.
+ * ARGUMENTS: . Comparison the predicate makes.
+ *            . Value the predicate compares to.
+ *            . Block of values.
+ *            . Number of values.
+ *            . Flags of the rows still kept.
+ *********************************************************************/
+static void filterBlock(int op, int value, const int *values, int count, unsigned char *keep);
 
-	if (record.death){ printf("Fatality: Yes\n"); }
-	else{ printf("Fatality: No\n"); }
-}
+/*********************************************************************
+ * FUNCTION NAME: blockColumn
+ * PURPOSE: Finds a column of the rows of a block, loading it the
+ *          first time a group query of the block uses it.
+ * ARGUMENTS: . Dataset containing the rows.
+ *            . Block of rows.
+ *            . Column to find.
+ * RETURNS: The values of the column.
+ *********************************************************************/
+static const int *blockColumn(Dataset *dataset, GroupBlock *block, int column);
 
-static int countRecords(FILE *file){
-	return ( (fileSize(file)-(SIZE_HEADER+SIZE_EOL) ) / (SIZE_RECORD+SIZE_EOL) );
-}
+/*********************************************************************
+ * FUNCTION NAME: runBlock
+ * PURPOSE: Adds a block of rows of the dataset to the table of a
+ *          group query.
+ * ARGUMENTS: . Dataset containing the rows.
+ *            . Block of rows at the level of the group query.
+ *            . Group query.
+ *            . Table of the group query.
+ *********************************************************************/
+static void runBlock(Dataset *dataset, GroupBlock *block, const GroupQuery *query, long long *cells);
 
-static void createRecord(Record **record){
-	*record = malloc(sizeof(Record));
-	(*record)->date.year = 0;
-	(*record)->date.month = 0;
-	(*record)->date.day = 0;
-	(*record)->gender = ' ';
-	(*record)->vehYear = 0;
-	(*record)->death = false;
-}
+/*********************************************************************
+ * FUNCTION NAME: planQueries
+ * PURPOSE: Lists the group queries a range of collisions is added to,
+ *          those answering the requested queries with empty tables
+ *          and every ad-hoc group query.
+ * ARGUMENTS: . Dataset containing the collisions.
+ *            . Aggregates the collisions are added to.
+ *            . Two group queries set up for query 1.
+ *            . Table of query 2.
+ *            . Table of query 5.
+ *            . Group queries and tables listed.
+ * RETURNS: The number of group queries listed.
+ *********************************************************************/
+static int planQueries(Dataset *dataset, Aggregates *agg, GroupQuery *month, long long *killed, long long *locs, GroupRun *runs);
 
-static void createDataset(Dataset **dataset){
-	*dataset = malloc(sizeof(Dataset));
-	(*dataset)->colNum = 0;
-	(*dataset)->recNum = 0;
-	(*dataset)->collisionIndex = NULL;
-	(*dataset)->records = NULL; 
-}
+/*********************************************************************
+ * FUNCTION NAME: foldQueries
+ * PURPOSE: Adds the tables of the group queries answering the
+ *          requested queries to their aggregates.
+ * ARGUMENTS: . Dataset the tables were counted from.
+ *            . Aggregates to add the tables to.
+ *            . Table of query 2.
+ *            . Table of query 5.
+ *********************************************************************/
+static void foldQueries(Dataset *dataset, Aggregates *agg, const long long *killed, const long long *locs);
 
-static void addRecord(Dataset *dataset, Record *record){	
-	dataset->recNum++;
-	
-	/*Allocate more memory for new record*/
-	if (dataset->records != NULL){
-		dataset->records = realloc(dataset->records,sizeof(Record*)*recCount(dataset));
-		dataset->records[recCount(dataset)-1] = record;
-	}
-	else{
-		dataset->records = malloc(sizeof(Record*));
-		dataset->records[0] = record;
-	}
-}
+/*********************************************************************
+ * FUNCTION NAME: addAdhoc
+ * PURPOSE: Adds empty tables for ad-hoc group queries to aggregates.
+ * ARGUMENTS: . Aggregates to add the tables to.
+ *            . Group queries, kept by the aggregates.
+ *            . Number of group queries.
+ *********************************************************************/
+static void addAdhoc(Aggregates *agg, GroupQuery *adhoc, int adhocNum);
 
-static void addIndex(Dataset *dataset, int index){
+/*********************************************************************
+ * FUNCTION NAME: columnNumber
+ * PURPOSE: Finds a column of a group query by name.
+ * ARGUMENTS: . Name of the column.
+ * RETURNS: Number of the column, -1 if there is no such column.
+ *********************************************************************/
+static int columnNumber(const char *name);
 
-	if (dataset->collisionIndex != NULL){
-		dataset->collisionIndex = realloc(dataset->collisionIndex,sizeof(int)*colCount(dataset));
-		dataset->collisionIndex[colCount(dataset)-1] = index-1;
-	}
-	else{
-		dataset->collisionIndex = malloc(sizeof(int));
-		dataset->collisionIndex[0] = index-1;
-	}
-}
+/*********************************************************************
+ * FUNCTION NAME: parseGroupQuery
+ * PURPOSE: Reads a group query written as space separated by=, 
+ *          where=, agg= and level= terms, e.g.
+ *          "by=year,month where=death=1,year>=2005 agg=count".
+ * ARGUMENTS: . Text of the group query, changed while parsing.
+ *            . Group query to fill in.
+ * RETURNS: True if the text describes a valid group query.
+ *********************************************************************/
+static bool parseGroupQuery(char *spec, GroupQuery *query);
 
-static int *startPositions(FILE *file, int workerCount){
-	int *index = malloc(sizeof(int)*workerCount);   //File position for each worker to start at
-	int totalSize = fileSize(file);
-	int sizeLeft = fileSize(file);
-	int approxIndex = 0;
-	int offset = 0, curWorker = 0;
-	char curLine[SIZE_RECORD+1],prevLine[SIZE_RECORD+1];
+/*********************************************************************
+ * FUNCTION NAME: printGroupQuery
+ * PURPOSE: Prints a line for every non-empty group of a group query.
+ * ARGUMENTS: . Number of the group query, starting at 1.
+ *            . Group query.
+ *            . Table of the group query.
+ *********************************************************************/
+static void printGroupQuery(int number, const GroupQuery *query, const long long *cells);
 
-	/*Account for header*/
-	totalSize -= SIZE_HEADER+SIZE_EOL;
-	sizeLeft -= SIZE_HEADER+SIZE_EOL;
+/*********************************************************************
+ * FUNCTION NAME: startProfile
+ * PURPOSE: Clears the profile of this process and starts MPE logging
+ *          of every phase if MPE is used.
+ *********************************************************************/
+static void startProfile(void);
 
-	/*Worker 1 always starts at beginning*/
-	index[0] = SIZE_HEADER+SIZE_EOL;
+/*********************************************************************
+ * FUNCTION NAME: profStart
+ * PURPOSE: Marks the start of a phase when profiling.
+ * ARGUMENTS: . Phase starting.
+ * RETURNS: Time the phase started, 0 when not profiling.
+ *********************************************************************/
+static double profStart(int phase);
 
-	/*Calculate where in the file each worker should start their job*/
-	for (curWorker=0;curWorker<workerCount-1;curWorker++){		
+/*********************************************************************
+ * FUNCTION NAME: profEnd
+ * PURPOSE: Adds the time since a phase started to the profile when
+ *          profiling.
+ * ARGUMENTS: . Phase ending.
+ *            . Time returned by profStart.
+ *********************************************************************/
+static void profEnd(int phase, double start);
 
-		approxIndex += sizeLeft/(workerCount-curWorker);  //Set to approximate index
-		approxIndex += (SIZE_RECORD+SIZE_EOL)-(approxIndex%(SIZE_RECORD+SIZE_EOL));  //Align index with a record in file
+/*********************************************************************
+ * FUNCTION NAME: openFile
+ * PURPOSE: Opens the file for reading, timed as part of opening and
+ *          sizing the file.
+ * ARGUMENTS: . Name of the file.
+ * RETURNS: The opened file, NULL if it could not be opened.
+ *********************************************************************/
+static FILE *openFile(char *fileName);
 
-		/*Seek to approximate index*/
-		fseek(file,approxIndex+SIZE_HEADER+SIZE_EOL,SEEK_SET);
+/*********************************************************************
+ * FUNCTION NAME: profCount
+ * PURPOSE: Adds bytes read and records parsed to the profile when
+ *          profiling.
+ * ARGUMENTS: . Bytes of the file read.
+ *            . Records parsed.
+ *********************************************************************/
+static void profCount(long bytes, long records);
 
-		/*Read first two lines*/
-		fread((void*)prevLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file);
-		prevLine[SIZE_RECORD] = '\0';
-		fread((void*)curLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file);
-		curLine[SIZE_RECORD] = '\0';
+/*********************************************************************
+ * FUNCTION NAME: sendProfile
+ * PURPOSE: Writes the profile of a worker to the master and ends its
+ *          MPE log.
+ * ARGUMENTS: . Number of the worker.
+ *********************************************************************/
+static void sendProfile(int num);
 
-		offset = SIZE_RECORD+SIZE_EOL;
-		/*Calculate how many records ahead of approximate index 
-		are part of the same collision*/
-		while (!diffCol(prevLine,curLine)){
-			offset += SIZE_RECORD+SIZE_EOL;
-			strcpy(prevLine,curLine);
-			fread((void*)curLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file);
-			curLine[SIZE_RECORD] = '\0';
-		}
-		index[curWorker+1] = approxIndex+offset+SIZE_HEADER+SIZE_EOL;       //Set workers index to last record of a collision
-		sizeLeft = totalSize-index[curWorker+1];              //Update the amount of work left
-	}
+/*********************************************************************
+ * FUNCTION NAME: printProfile
+ * PURPOSE: Prints the phases and counts of one process as
+ *          $PROF,process,phase,calls,seconds lines.
+ * ARGUMENTS: . Process number, 0 for the master.
+ *            . Profile of the process.
+ *********************************************************************/
+static void printProfile(int process, Profile *report);
 
-	return index;
-}
+/*********************************************************************
+ * FUNCTION NAME: gatherProfiles
+ * PURPOSE: Reads the profile of every worker, prints them with the
+ *          profile of the master and the spread of each phase over
+ *          the workers, then ends the MPE log of the master.
+ *********************************************************************/
+static void gatherProfiles(void);
 
-static Record *getRecord(char *recLine){
-	int col;        //column
-	char *token = NULL;
-	char line[SIZE_RECORD+1];
-	Record *record;
+/*********************************************************************
+ * FUNCTION NAME: beginAnswers
+ * PURPOSE: Buffers the answers that follow when verifying, so they can
+ *          be compared with the answers of a serial pass.
+ *********************************************************************/
+static void beginAnswers(void);
 
-	createRecord(&record);
+/*********************************************************************
+ * FUNCTION NAME: serialAnswers
+ * PURPOSE: Answers queries from one pass over the whole file by this
+ *          process alone, with the scalar decoder and the stdio reader
+ *          and without the index, cube or threads.
+ * ARGUMENTS: . Name of the file.
+ *            . Queries requested.
+ *            . Number of queries requested.
+ *            . Ad-hoc group queries requested.
+ *            . Number of ad-hoc group queries.
+ * RETURNS: Text of the answers, NULL if the file could not be read.
+ *********************************************************************/
+static char *serialAnswers(char *fileName, int *queries, int queryNum, GroupQuery *adhoc, int adhocNum);
 
-	strcpy(line,recLine);
-	token = strtok(line,",");
+/*********************************************************************
+ * FUNCTION NAME: endAnswers
+ * PURPOSE: Prints the buffered answers when verifying and aborts if
+ *          they differ from the answers of a serial pass.
+ * ARGUMENTS: . Name of the file.
+ *            . Queries requested.
+ *            . Number of queries requested.
+ *            . Ad-hoc group queries requested.
+ *            . Number of ad-hoc group queries.
+ *********************************************************************/
+static void endAnswers(char *fileName, int *queries, int queryNum, GroupQuery *adhoc, int adhocNum);
 
-	//Go through every column and store data if it is needed
-	for (col=1; col<COL_COUNT+1; col++){
-		
+/*********************************************************************
+ * FUNCTION NAME: printBench
+ * PURPOSE: Prints one line of benchmark results as
+ *          $BENCH,phase,workers,records,seconds,records per second.
+ * ARGUMENTS: . Name of the phase measured.
+ *            . Number of workers taking part.
+ *            . Number of records processed.
+ *            . Seconds taken.
+ *********************************************************************/
+static void printBench(char *phase, int workers, long records, double seconds);
 
-		switch(col){
-			case COL_CYEAR:
-				record->date.year = strtol(token,NULL,10);
-				break;
+/*********************************************************************
+ * FUNCTION NAME: runBench
+ * PURPOSE: Times each phase of answering queries on its own over the
+ *          whole file: loading with each reader, finding collision
+ *          boundaries and every query.
+ * ARGUMENTS: . Name of the file to measure.
+ *********************************************************************/
+static void runBench(char *fileName);
 
-			case COL_MNTH:
-				record->date.month = strtol(token,NULL,10);
-				break;
+/*********************************************************************
+ * FUNCTION NAME: answerAdhoc
+ * PURPOSE: Prints the answer to every ad-hoc group query, reading
+ *          the table of each worker if there are workers.
+ * ARGUMENTS: . Group queries.
+ *            . Number of group queries.
+ *            . Aggregates holding the tables, NULL to read them from
+ *              the workers.
+ *********************************************************************/
+static void answerAdhoc(GroupQuery *adhoc, int adhocNum, Aggregates *local);
 
-			case COL_DAY:
-				record->date.day = strtol(token,NULL,10);
-				break;
+/*********************************************************************
+ * FUNCTION NAME: createCube
+ * PURPOSE: Allocate memory for an empty data cube.
+ * ARGUMENTS: . Address of the pointer to the cube.
+ *********************************************************************/
+static void createCube(Cube **cube);
 
-			case COL_SEV:
-				record->death = (strcmp(token,"3") == 0);
-				break;
-			
-			case COL_VEHN:
-				if (token[0] == '0'){
-					record->vehNum = token[1] - '0';
-				}
-				else{
-					record->vehNum = strtol(token,NULL,10);
-				}
+/*********************************************************************
+ * FUNCTION NAME: freeCube
+ * PURPOSE: Frees a data cube.
+ * ARGUMENTS: . Cube to free, may be NULL.
+ *********************************************************************/
+static void freeCube(Cube *cube);
 
-			case COL_LOC:
-				if (strcmp(token,"QQ") == 0){
-					record->location = 0;
-				}
-				else if (strtol(token,NULL,10) == 0){
-					record->location = -1;
-				}
-				else{
-					record->location = strtol(token,NULL,10);
-				}
-				break;
-			case COL_VID:
-				if (token[0] == '0'){
-					record->vehID = token[1] - '0';
-				}
-				else{
-					record->vehID = strtol(token,NULL,10);
-				}				
-				break;
+/*********************************************************************
+ * FUNCTION NAME: growCube
+ * PURPOSE: Widens the years of a data cube to cover a range, keeping
+ *          the counts of the years it held.
+ * ARGUMENTS: . Cube to widen.
+ *            . First year of the range.
+ *            . Last year of the range.
+ *********************************************************************/
+static void growCube(Cube *cube, int firstYear, int lastYear);
 
-			case COL_VYEAR:
-				record->vehYear = strtol(token,NULL,10); //strtol returns 0 to vehyear if year is not provided in csv
-				break;
+/*********************************************************************
+ * FUNCTION NAME: addToCube
+ * PURPOSE: Adds one collision to the data cube.
+ * ARGUMENTS: . Dataset containing the collision.
+ *            . Index of the first record of the collision.
+ *            . Index after the last record of the collision.
+ *            . Cube to add the collision to.
+ *********************************************************************/
+static void addToCube(Dataset *dataset, int first, int last, Cube *cube);
 
-			case COL_SEX:
-				record->gender = token[0];
-				break;
-		}
+/*********************************************************************
+ * FUNCTION NAME: mergeCube
+ * PURPOSE: Adds the cube of one partition to the cube of the 
+ *          partition before it.
+ * ARGUMENTS: . Cube to add to.
+ *            . Cube of the following partition.
+ *********************************************************************/
+static void mergeCube(Cube *cube, Cube *next);
 
-		/*Tokenize the next column*/
-		token = strtok(NULL,",");
+/*********************************************************************
+ * FUNCTION NAME: cubeAnswers
+ * PURPOSE: Fills the aggregates of every query the cube can answer
+ *          by summing over the dimensions each query ignores.
+ * ARGUMENTS: . Cube of the whole file.
+ * RETURNS: Aggregates of queries 1, 2, 3 and 5.
+ *********************************************************************/
+static Aggregates *cubeAnswers(Cube *cube);
 
-	}
+/*********************************************************************
+ * FUNCTION NAME: cubeFilter
+ * PURPOSE: Gets the queries the workers still have to answer.
+ * ARGUMENTS: . Queries requested.
+ *            . Number of queries requested.
+ *            . Address to store the newly allocated remaining queries.
+ * RETURNS: Number of remaining queries.
+ *********************************************************************/
+static int cubeFilter(int *queries, int queryNum, int **rest);
 
-	return record;
-}
-int ***collEachMonth(Dataset *dataset){
-	int ***tally;
-	int year,month;
-	int i,j,index;
+/*********************************************************************
+ * FUNCTION NAME: scanDataset
+ * PURPOSE: Computes the aggregates of every requested query in a 
+ *          single pass over the collisions of the dataset.
+ * ARGUMENTS: . Dataset to scan.
+ *            . Aggregates to add the dataset to.
+ *********************************************************************/
+static void scanDataset(Dataset *dataset, Aggregates *agg);
 
-	tally = malloc(sizeof(int**)*14);
-	for (i=0;i<14;i++){
+/*********************************************************************
+ * FUNCTION NAME: dropRecords
+ * PURPOSE: Removes records from the front of the dataset, keeping 
+ *          the collision indexes of the records left.
+ * ARGUMENTS: . Dataset to remove from.
+ *            . Number of records to remove, must start a collision.
+ *********************************************************************/
+static void dropRecords(Dataset *dataset, int count);
 
-		tally[i] = malloc(sizeof(int*)*12);
-		for (j=0;j<12;j++){
-			tally[i][j] = malloc(sizeof(int)*2);
-			tally[i][j][0] = 0;
-			tally[i][j][1] = 0;	
-		}
-	}
-	//Count number of fatalities in each month and number of collisions in each month
-	
-	//Go through each collision record index
-		//Add one to  tally[YEAR][MONTH][COLL]
-		//Add one to tally[YEAR][MONTH][FATA] if fatality occurred
-	for (i=0;i<dataset->colNum;i++){
-		index = dataset->collisionIndex[i];
-		
-		month = dataset->records[index]->date.month;
-		year = dataset->records[index]->date.year;
+/*********************************************************************
+ * FUNCTION NAME: streamDataset
+ * PURPOSE: Aggregates a partition of the file chunk by chunk without
+ *          storing it, holding only the collision that continues 
+ *          past the current chunk.
+ * ARGUMENTS: . File to be read from.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read.
+ *            . Aggregates to add the partition to.
+ * RETURNS: True if the partition was read, false otherwise.
+ *********************************************************************/
+static bool streamDataset(FILE *file, long startPos, long readLength, Aggregates *agg);
 
-		if (month > 0 && year > 0){	
-			tally[year-1999][month-1][0]++;
-		}	
-	}
-	
-	for (i=0;i<dataset->recNum;i++){
-		
-		month = dataset->records[i]->date.month;
-		year = dataset->records[i]->date.year;
+/*********************************************************************
+ * FUNCTION NAME: aggregatePartition
+ * PURPOSE: Aggregates a partition of the file, either by loading it
+ *          or by streaming it. Partitions of converted files are 
+ *          given in collisions rather than bytes.
+ * ARGUMENTS: . File to be read from.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read.
+ *            . Aggregates to add the partition to.
+ * RETURNS: True if the partition was read, false otherwise.
+ *********************************************************************/
+static bool aggregatePartition(FILE *file, long startPos, long readLength, Aggregates *agg);
 
-		if (month > 0 && year > 0){	
-			if (dataset->records[i]->death){
-				tally[year-1999][month-1][1]++;
-			}
-		}	
-	}
-	return tally;
-}
+/*********************************************************************
+ * FUNCTION NAME: growTally
+ * PURPOSE: Widens the monthly tally of aggregates to cover a range 
+ *          of years, keeping the counts already in it.
+ * ARGUMENTS: . Aggregates holding the tally.
+ *            . First year to cover.
+ *            . Last year to cover.
+ *********************************************************************/
+static void growTally(Aggregates *agg, int firstYear, int lastYear);
 
-static Dataset *partDataset(FILE *file, int startPos, int readLength){
-	Dataset *dataset = NULL;
-	Record *record = NULL;
-	int i,readCount;
-	char line[SIZE_RECORD+SIZE_EOL+1], prevLine[SIZE_RECORD+SIZE_EOL+1];
+/*********************************************************************
+ * FUNCTION NAME: addTally
+ * PURPOSE: Adds a monthly tally covering any range of years to the
+ *          tally of aggregates.
+ * ARGUMENTS: . Aggregates to add to.
+ *            . First year of the tally to add.
+ *            . Number of years in the tally to add.
+ *            . Tally to add, indexed with TALLY.
+ *********************************************************************/
+static void addTally(Aggregates *agg, int firstYear, int yearNum, const int *tally);
 
-	createDataset(&dataset);
+/*********************************************************************
+ * FUNCTION NAME: trackYears
+ * PURPOSE: Widens the range of years seen in a dataset to cover 
+ *          records just added to it.
+ * ARGUMENTS: . Dataset the records were added to.
+ *            . Index of the first record added.
+ *            . Number of records added.
+ *********************************************************************/
+static void trackYears(Dataset *dataset, int first, int count);
+
+/*********************************************************************
+ * FUNCTION NAME: mergeAggregates
+ * PURPOSE: Adds the aggregates of one partition to the aggregates of
+ *          the partition before it.
+ * ARGUMENTS: . Aggregates to add to.
+ *            . Aggregates of the following partition.
+ *********************************************************************/
+static void mergeAggregates(Aggregates *agg, Aggregates *next);
+
+/*********************************************************************
+ * FUNCTION NAME: splitPartition
+ * PURPOSE: Splits a partition of the file into parts that each 
+ *          start at a collision.
+ * ARGUMENTS: . File the partition is in.
+ *            . Position of the partition in the file.
+ *            . Length of the partition.
+ *            . Number of parts to split it into.
+ * RETURNS: Integer array of size parts+1 containing the position of
+ *          each part followed by the end of the partition.
+ *********************************************************************/
+static long *splitPartition(FILE *file, long startPos, long readLength, int parts);
+
+/*********************************************************************
+ * FUNCTION NAME: loadPartition
+ * PURPOSE: Loads a partition of the file, either csv or converted.
+ * ARGUMENTS: . File to be read from.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read, or collisions if converted.
+ * RETURNS: Address of Dataset containing the partition, NULL if it
+ *          could not be read.
+ *********************************************************************/
+static Dataset *loadPartition(FILE *file, long startPos, long readLength);
+
+/*********************************************************************
+ * FUNCTION NAME: freeAggregates
+ * PURPOSE: Frees the memory of a set of aggregates.
+ * ARGUMENTS: . Aggregates to free.
+ *********************************************************************/
+static void freeAggregates(Aggregates *agg);
+
+/*********************************************************************
+ * FUNCTION NAME: runThreads
+ * PURPOSE: Splits a partition of the file between threadNum threads
+ *          and waits for each of them to finish its part.
+ * ARGUMENTS: . Name of the file.
+ *            . File to be read from.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read.
+ *            . Aggregates whose queries and cube each thread 
+ *              aggregates, NULL to only load.
+ * RETURNS: Array of threadNum finished jobs in partition order.
+ *********************************************************************/
+static ThreadJob *runThreads(char *fileName, FILE *file, long startPos, long readLength, Aggregates *agg);
+
+/*********************************************************************
+ * FUNCTION NAME: residentPartition
+ * PURPOSE: Loads a partition of the file to be kept in memory, 
+ *          split between threadNum threads.
+ * ARGUMENTS: . Name of the file.
+ *            . File to be read from.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read.
+ *            . Address to store the number of datasets loaded.
+ * RETURNS: Array of the datasets loaded in partition order.
+ *********************************************************************/
+static Dataset **residentPartition(char *fileName, FILE *file, long startPos, long readLength, int *datasetNum);
+
+/*********************************************************************
+ * FUNCTION NAME: readRequest
+ * PURPOSE: Reads a line of query numbers, or a group query following
+ *          the letter g, from stdin.
+ * ARGUMENTS: . Address to store the newly allocated query array.
+ *            . Address to store the newly allocated group query.
+ *            . Address to store the number of group queries.
+ * RETURNS: Number of queries on the line, -1 at the end of input.
+ *********************************************************************/
+static int readRequest(int **queries, GroupQuery **adhoc, int *adhocNum);
+
+/*********************************************************************
+ * FUNCTION NAME: sendResults
+ * PURPOSE: Writes the results of a worker to the master, through the
+ *          reduction tree if one is used.
+ * ARGUMENTS: . Number of the worker.
+ *            . Aggregates of the worker.
+ *            . Queries requested in the order answered.
+ *            . Number of queries requested.
+ *********************************************************************/
+static void sendResults(int num, Aggregates *agg, int *queries, int queryNum);
+
+/*********************************************************************
+ * FUNCTION NAME: gatherCubes
+ * PURPOSE: Reads the cube of every worker and merges them in file
+ *          order.
+ * RETURNS: Cube of the whole file.
+ *********************************************************************/
+static Cube *gatherCubes(void);
+
+/*********************************************************************
+ * FUNCTION NAME: gatherResults
+ * PURPOSE: Reads the record counts the workers found, aborting if
+ *          records went missing.
+ * ARGUMENTS: . Bitmask of the queries requested.
+ *            . Ad-hoc group queries requested.
+ *            . Number of ad-hoc group queries.
+ *            . Number of records in the file.
+ * RETURNS: Aggregates of every worker when they were reduced in a 
+ *          tree, NULL when each worker sends its own results.
+ *********************************************************************/
+static Aggregates *gatherResults(int queries, GroupQuery *adhoc, int adhocNum, long recReal);
+
+/*********************************************************************
+ * FUNCTION NAME: answerQueries
+ * PURPOSE: Prints the answer of each query in the order requested.
+ * ARGUMENTS: . Queries requested.
+ *            . Number of queries requested.
+ *            . Aggregates to answer from, NULL to read the results
+ *              of each worker.
+ *********************************************************************/
+static void answerQueries(int *queries, int queryNum, Aggregates *local);
+
+/*********************************************************************
+ * FUNCTION NAME: threadJob
+ * PURPOSE: Aggregates or loads one part of a partition on its own 
+ *          thread.
+ * ARGUMENTS: . Address of the ThreadJob to run.
+ * RETURNS: NULL.
+ *********************************************************************/
+static void *threadJob(void *job);
+
+/*********************************************************************
+ * FUNCTION NAME: threadPartition
+ * PURPOSE: Aggregates a partition of the file, splitting it between
+ *          threadNum threads and merging what each thread found.
+ * ARGUMENTS: . Name of the file.
+ *            . File to be read from.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read.
+ *            . Aggregates to add the partition to.
+ * RETURNS: True if the partition was read, false otherwise.
+ *********************************************************************/
+static bool threadPartition(char *fileName, FILE *file, long startPos, long readLength, Aggregates *agg);
+
+/*********************************************************************
+ * FUNCTION NAME: scheduleChunks
+ * PURPOSE: Hands out chunks of the file to whichever worker asks for
+ *          one next, then tells every worker there are none left.
+ * ARGUMENTS: . Number of chunks the file was split into.
+ *********************************************************************/
+static void scheduleChunks(int chunkNum);
+
+/*********************************************************************
+ * FUNCTION NAME: collectiveDataset
+ * PURPOSE: Opens the file on every rank at once and reads each 
+ *          rank's partition with one collective read. Every rank 
+ *          must call it, the master with a length of 0.
+ * ARGUMENTS: . Name of the file.
+ *            . Position of the file to start reading from.
+ *            . How many bytes to read.
+ * RETURNS: Address of Dataset containing all records found in the 
+ *          partition, NULL if nothing was read or the read failed.
+ *********************************************************************/
+static Dataset *collectiveDataset(char *fileName, long startPos, long readLength);
+
+/*********************************************************************
+ * FUNCTION NAME: packAggregates
+ * PURPOSE: Copies aggregates and the tables of their ad-hoc group
+ *          queries into a long long array so they can be sent in one
+ *          message, sums of the tables need more than an int.
+ * ARGUMENTS: . Aggregates to pack.
+ *            . Address to store the newly allocated array.
+ * RETURNS: Number of integers in the array.
+ *********************************************************************/
+static int packAggregates(Aggregates *agg, long long **packed);
+
+/*********************************************************************
+ * FUNCTION NAME: packCube
+ * PURPOSE: Copies a data cube into an integer array so it can be sent
+ *          in one message.
+ * ARGUMENTS: . Cube to pack.
+ *            . Address to store the newly allocated array.
+ * RETURNS: Number of integers in the array.
+ *********************************************************************/
+static int packCube(Cube *cube, int **packed);
+
+/*********************************************************************
+ * FUNCTION NAME: unpackCube
+ * PURPOSE: Copies a data cube out of an array filled by packCube.
+ * ARGUMENTS: . Array to unpack.
+ * RETURNS: The new cube.
+ *********************************************************************/
+static Cube *unpackCube(int *packed);
+
+/*********************************************************************
+ * FUNCTION NAME: unpackAggregates
+ * PURPOSE: Copies aggregates out of an array filled by 
+ *          packAggregates.
+ * ARGUMENTS: . Empty aggregates to fill, with the same ad-hoc group
+ *              queries as the aggregates packed.
+ *            . Array filled by packAggregates.
+ *********************************************************************/
+static void unpackAggregates(Aggregates *agg, long long *packed);
+
+/*********************************************************************
+ * FUNCTION NAME: reduceTree
+ * PURPOSE: Combines the aggregates of every worker in a binomial 
+ *          tree, worker 0 ends up with the aggregates of the whole
+ *          file in log2(W) steps.
+ * ARGUMENTS: . Number of the worker.
+ *            . Aggregates of the worker, merged in place.
+ *********************************************************************/
+static void reduceTree(int num, Aggregates *agg);
+
+/*********************************************************************
+ * FUNCTION NAME: convertFile
+ * PURPOSE: Parses a whole csv file and writes it as a converted file.
+ * ARGUMENTS: . Csv file to convert.
+ *            . Name of the converted file to create.
+ *            . Number of workers to record split points for.
+ * RETURNS: True if the file was converted, false otherwise.
+ *********************************************************************/
+static bool convertFile(FILE *file, char *fileName, int splitNum);
+
+/*********************************************************************
+ * FUNCTION NAME: binaryLayout
+ * PURPOSE: Calculates where each array of a converted file starts.
+ *          Arrays are stored in the order year, month, day, location,
+ *          gender, vehYear, vehNum, vehID, death, collisionIndex.
+ * ARGUMENTS: . Header of the converted file.
+ *            . Array of BINARY_ARRAYS+1 offsets to fill, the last 
+ *              receiving the size of the file.
+ *            . Array of BINARY_ARRAYS sizes to fill.
+ *********************************************************************/
+static void binaryLayout(BinaryHeader *header, size_t *offset, size_t *size);
+
+/*********************************************************************
+ * FUNCTION NAME: readBinaryHeader
+ * PURPOSE: Checks whether a file was written by writeBinary.
+ * ARGUMENTS: . File to check.
+ * RETURNS: Address of the header of the file, NULL if the file is 
+ *          not a converted file this build can read.
+ *********************************************************************/
+static BinaryHeader *readBinaryHeader(FILE *file);
+
+/*********************************************************************
+ * FUNCTION NAME: writeBinary
+ * PURPOSE: Writes a dataset to a columnar file that can be mapped
+ *          back without parsing.
+ * ARGUMENTS: . Name of the file to create.
+ *            . Dataset holding every record of the csv file.
+ *            . Number of workers to record split points for.
+ * RETURNS: True if the file was written, false otherwise.
+ *********************************************************************/
+static bool writeBinary(char *fileName, Dataset *dataset, int splitNum);
+
+/*********************************************************************
+ * FUNCTION NAME: binaryPositions
+ * PURPOSE: Gets the first collision of each worker in a converted 
+ *          file, balancing the number of records.
+ * ARGUMENTS: . File being read by workers.
+ *            . Number of workers performing the job.
+ * RETURNS: Integer array of size workerCount containing the first
+ *          collision of each worker.
+ *********************************************************************/
+static long *binaryPositions(FILE *file, int workerCount);
+
+/*********************************************************************
+ * FUNCTION NAME: mapRange
+ * PURPOSE: Maps part of a converted file for a dataset, which unmaps
+ *          it when it is freed.
+ * ARGUMENTS: . Dataset keeping the mapping.
+ *            . Descriptor of the file to be mapped.
+ *            . Position in the file of the part.
+ *            . Length of the part.
+ * RETURNS: Address of the part, NULL if it could not be mapped.
+ *********************************************************************/
+static const char *mapRange(Dataset *dataset, int fd, size_t offset, size_t length);
+
+/*********************************************************************
+ * FUNCTION NAME: mapBinary
+ * PURPOSE: Creates a dataset over a range of collisions of a 
+ *          converted file. Only the part of each array holding the
+ *          range is mapped, record columns point into it and are
+ *          never copied.
+ * ARGUMENTS: . Descriptor of the file to be mapped.
+ *            . Index of the first collision to include.
+ *            . Number of collisions to include.
+ * RETURNS: Address of Dataset containing the collisions, NULL if 
+ *          the file could not be mapped.
+ *********************************************************************/
+static Dataset *mapBinary(int fd, int firstCol, int colLength);
+
+/*********************************************************************
+ * FUNCTION NAME: createArena
+ * PURPOSE: Allocate an arena that hands out memory from large blocks
+ *          and releases all of it at once.
+ * ARGUMENTS: . Address of the pointer to the arena.
+ *            . Bytes in the first block.
+ *********************************************************************/
+static void createArena(Arena **arena, size_t size);
+
+/*********************************************************************
+ * FUNCTION NAME: arenaAlloc
+ * PURPOSE: Hands out cache line aligned memory from an arena, adding
+ *          a block if the current one is full.
+ * ARGUMENTS: . Arena to allocate from.
+ *            . Bytes needed.
+ * RETURNS: Address of the memory, valid until the arena is freed.
+ *********************************************************************/
+static void *arenaAlloc(Arena *arena, size_t size);
+
+/*********************************************************************
+ * FUNCTION NAME: arenaGrow
+ * PURPOSE: Moves an array allocated from an arena to a larger one.
+ * ARGUMENTS: . Arena to allocate from.
+ *            . Array to move, NULL if there is none yet.
+ *            . Bytes of the array to keep.
+ *            . Bytes needed.
+ * RETURNS: Address of the new array.
+ *********************************************************************/
+static void *arenaGrow(Arena *arena, void *old, size_t oldSize, size_t size);
+
+/*********************************************************************
+ * FUNCTION NAME: freeArena
+ * PURPOSE: Releases every block of an arena and the arena itself.
+ * ARGUMENTS: . Arena to release.
+ *********************************************************************/
+static void freeArena(Arena *arena);
+
+/*********************************************************************
+ * FUNCTION NAME: createDataset
+ * PURPOSE: Allocate memory and initialize dataset. The dataset and
+ *          its columns come from one arena sized for the records 
+ *          expected.
+ * ARGUMENTS: . Address of the pointer to the dataset.
+ *            . Number of records expected to be added.
+ *********************************************************************/
+static void createDataset(Dataset **dataset, int recHint);
+
+/*********************************************************************
+ * FUNCTION NAME: freeDataset
+ * PURPOSE: Releases a dataset and all of its columns.
+ * ARGUMENTS: . Dataset to release.
+ *********************************************************************/
+static void freeDataset(Dataset *dataset);
+
+/*********************************************************************
+ * FUNCTION NAME: growCapacity
+ * PURPOSE: Calculates the new capacity of a growing array so that
+ *          appending n elements costs O(n) copying in total.
+ * ARGUMENTS: . Current capacity of the array.
+ *            . Number of elements the array must be able to hold.
+ * RETURNS: Integer containing the new capacity.
+ *********************************************************************/
+static int growCapacity(int capacity, int needed);
+
+/*********************************************************************
+ * FUNCTION NAME: reserveRecords
+ * PURPOSE: Resizes every record column of the dataset.
+ * ARGUMENTS: . Dataset to resize.
+ *            . Number of records to reserve memory for.
+ *********************************************************************/
+static void reserveRecords(Dataset *dataset, int capacity);
+
+/*********************************************************************
+ * FUNCTION NAME: reserveIndexes
+ * PURPOSE: Resizes the collision index array of the dataset.
+ * ARGUMENTS: . Dataset to resize.
+ *            . Number of collision indexes to reserve memory for.
+ *********************************************************************/
+static void reserveIndexes(Dataset *dataset, int capacity);
+/*********************************************************************/
+static inline bool diffCol(const char *rec1, const char *rec2){
+	uint64_t coll1[LENGTH_COLL/8], coll2[LENGTH_COLL/8], collDiff = 0;
+	uint32_t vyear1, vyear2;
+	uint16_t vtype1, vtype2;
+	int i, first1, first2;
+
+	/*Collision level information as whole words*/
+	memcpy(coll1, rec1, LENGTH_COLL);
+	memcpy(coll2, rec2, LENGTH_COLL);
+	for (i=0;i<LENGTH_COLL/8;i++){
+		collDiff |= coll1[i]^coll2[i];
+	}
+
+	memcpy(&vyear1, rec1+OFF_VYEAR, sizeof(uint32_t));
+	memcpy(&vyear2, rec2+OFF_VYEAR, sizeof(uint32_t));
+	memcpy(&vtype1, rec1+OFF_VTYPE, sizeof(uint16_t));
+	memcpy(&vtype2, rec2+OFF_VTYPE, sizeof(uint16_t));
+
+	/*Vehicle id is 01*/
+	first1 = (rec1[OFF_VID] == '0') & (rec1[OFF_VID+1] == '1');
+	first2 = (rec2[OFF_VID] == '0') & (rec2[OFF_VID+1] == '1');
+
+	/*Coll level information changed, vehicle id changed to 1 or 
+	vehicle type or year changed between two first vehicles*/
+	return (collDiff != 0) 
+		| (first2 & ~first1) 
+		| (first1 & first2 & (((vyear1^vyear2) | (vtype1^vtype2)) != 0));
+}	
+
+static void markBoundaries(const char *block, int count, const char *prevLine, uint64_t *bounds){
+	const char *line;
+	int i;
+
+	memset(bounds, 0, sizeof(uint64_t)*((count+63)/64));
+	if (count == 0){
+		return;
+	}
+	bounds[0] = prevLine == NULL ? 1 : diffCol(prevLine, block);
+
+	for (i=1; i<count; i++){
+		line = block + i*(SIZE_RECORD+SIZE_EOL);
+		bounds[i>>6] |= (uint64_t)diffCol(line-(SIZE_RECORD+SIZE_EOL), line) << (i&63);
+	}
+}
+
+static int recCount(Dataset *dataset){
+	return dataset->recNum;
+}
+
+static int colCount(Dataset *dataset){
+	return dataset->colNum;
+}
+
+static long fileSize(FILE *file){
+	long size;
+
+	fseek(file,0,SEEK_END);
+	size = ftell(file);
+	rewind(file);
+
+	return size;
+}
+
+static void printRecord(Record record){
+	printf("RECORD INFO - Year:%d\tMonth:%d\tDay:%d\tGender:%c\tVehicle Year:%d\t"
+		,record.date.year,record.date.month,record.date.day,record.gender,record.vehYear);
+
+	if (record.death){ printf("Fatality: Yes\n"); }
+	else{ printf("Fatality: No\n"); }
+}
+
+static long countRecords(FILE *file){
+	return ( (fileSize(file)-(SIZE_HEADER+SIZE_EOL) ) / (SIZE_RECORD+SIZE_EOL) );
+}
+
+static void createArena(Arena **arena, size_t size){
+	size = ALIGN_ARENA(size < ARENA_MIN ? ARENA_MIN : size);
+
+	*arena = malloc(sizeof(Arena));
+	(*arena)->base = aligned_alloc(ARENA_ALIGN, size);
+	(*arena)->size = size;
+	(*arena)->used = 0;
+	(*arena)->next = NULL;
+}
+
+static void *arenaAlloc(Arena *arena, size_t size){
+	Arena *full;
+	void *memory;
+
+	size = ALIGN_ARENA(size);
+
+	/*The full block is kept behind the arena so the arena
+	itself never moves*/
+	if (arena->used + size > arena->size){
+		full = malloc(sizeof(Arena));
+		*full = *arena;
+		arena->next = full;
+		arena->size = size < ARENA_MIN ? ARENA_MIN : size;
+		arena->base = aligned_alloc(ARENA_ALIGN, arena->size);
+		arena->used = 0;
+	}
+	memory = arena->base + arena->used;
+	arena->used += size;
+
+	return memory;
+}
+
+static void *arenaGrow(Arena *arena, void *old, size_t oldSize, size_t size){
+	void *memory = arenaAlloc(arena, size);
+
+	if (old != NULL && oldSize > 0){
+		memcpy(memory, old, oldSize < size ? oldSize : size);
+	}
+	return memory;
+}
+
+static void freeArena(Arena *arena){
+	Arena *next;
+
+	while (arena != NULL){
+		next = arena->next;
+		free(arena->base);
+		free(arena);
+		arena = next;
+	}
+}
+
+static void createDataset(Dataset **dataset, int recHint){
+	Arena *arena;
+
+	/*Room for every column of the records expected, the indexes of
+	their collisions and the padding of each array*/
+	createArena(&arena, sizeof(Dataset) + (size_t)recHint*(2*sizeof(short)+6) + (recHint+7)/8
+		+ sizeof(int)*(recHint/REC_PER_COL+1) + 12*ARENA_ALIGN);
+
+	*dataset = arenaAlloc(arena, sizeof(Dataset));
+	(*dataset)->arena = arena;
+	(*dataset)->minYear = INT_MAX;
+	(*dataset)->maxYear = 0;
+	(*dataset)->firstRecord = 0;
+	(*dataset)->mapNum = 0;
+	(*dataset)->colNum = 0;
+	(*dataset)->recNum = 0;
+	(*dataset)->colCap = 0;
+	(*dataset)->recCap = 0;
+	(*dataset)->collisionIndex = NULL;
+	(*dataset)->year = NULL;
+	(*dataset)->month = NULL;
+	(*dataset)->day = NULL;
+	(*dataset)->location = NULL;
+	(*dataset)->gender = NULL;
+	(*dataset)->vehYear = NULL;
+	(*dataset)->vehNum = NULL;
+	(*dataset)->vehID = NULL;
+	(*dataset)->death = NULL;
+
+	/*Reserve everything up front so the common case is one allocation*/
+	if (recHint > 0){
+		reserveRecords(*dataset,recHint);
+		reserveIndexes(*dataset,recHint/REC_PER_COL+1);
+	}
+}
+
+static void freeDataset(Dataset *dataset){
+	int i;
+
+	for (i=0;i<dataset->mapNum;i++){
+		munmap(dataset->maps[i], dataset->mapSizes[i]);
+	}
+	freeArena(dataset->arena);
+}
+
+static int growCapacity(int capacity, int needed){
+	if (capacity < 16){
+		capacity = 16;
+	}
+	while (capacity < needed){
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+static void reserveRecords(Dataset *dataset, int capacity){
+	Arena *arena = dataset->arena;
+	int oldBytes = (dataset->recCap+7)/8;
+	int newBytes = (capacity+7)/8;
+	int old = dataset->recCap;
+
+	/*Columns that outgrow their space move further into the arena,
+	the space left behind is released with the arena*/
+	dataset->year = arenaGrow(arena,dataset->year,sizeof(short)*old,sizeof(short)*capacity);
+	dataset->month = arenaGrow(arena,dataset->month,sizeof(signed char)*old,sizeof(signed char)*capacity);
+	dataset->day = arenaGrow(arena,dataset->day,sizeof(signed char)*old,sizeof(signed char)*capacity);
+	dataset->location = arenaGrow(arena,dataset->location,sizeof(signed char)*old,sizeof(signed char)*capacity);
+	dataset->gender = arenaGrow(arena,dataset->gender,sizeof(char)*old,sizeof(char)*capacity);
+	dataset->vehYear = arenaGrow(arena,dataset->vehYear,sizeof(short)*old,sizeof(short)*capacity);
+	dataset->vehNum = arenaGrow(arena,dataset->vehNum,sizeof(signed char)*old,sizeof(signed char)*capacity);
+	dataset->vehID = arenaGrow(arena,dataset->vehID,sizeof(signed char)*old,sizeof(signed char)*capacity);
+	dataset->death = arenaGrow(arena,dataset->death,oldBytes,newBytes);
+
+	/*Deaths are or'ed into the bitset so new bytes start cleared*/
+	if (newBytes > oldBytes){
+		memset(dataset->death+oldBytes,0,newBytes-oldBytes);
+	}
+	dataset->recCap = capacity;
+}
+
+static void reserveIndexes(Dataset *dataset, int capacity){
+	dataset->collisionIndex = arenaGrow(dataset->arena,dataset->collisionIndex,sizeof(int)*dataset->colCap,sizeof(int)*capacity);
+	dataset->colCap = capacity;
+}
+
+static void addRecord(Dataset *dataset, Record *record){	
+	int i = recCount(dataset);
+
+	dataset->recNum++;
+	
+	/*Allocate more memory in each column if reserved space is used up*/
+	if (recCount(dataset) > dataset->recCap){
+		reserveRecords(dataset,growCapacity(dataset->recCap,recCount(dataset)));
+	}
+
+	dataset->year[i] = record->date.year;
+	dataset->month[i] = record->date.month;
+	dataset->day[i] = record->date.day;
+	dataset->location[i] = record->location;
+	dataset->gender[i] = record->gender;
+	dataset->vehYear[i] = record->vehYear;
+	dataset->vehNum[i] = record->vehNum;
+	dataset->vehID[i] = record->vehID;
+	dataset->death[i/8] |= record->death << (i%8);
+}
+
+static void addIndex(Dataset *dataset, int index){
+
+	if (colCount(dataset) > dataset->colCap){
+		reserveIndexes(dataset,growCapacity(dataset->colCap,colCount(dataset)));
+	}
+	dataset->collisionIndex[colCount(dataset)-1] = index-1;
+}
+
+static long *startPositions(FILE *file, int workerCount){
+	long *index = malloc(sizeof(long)*workerCount);   //File position for each worker to start at
+	long totalSize = fileSize(file);
+	long sizeLeft = fileSize(file);
+	long approxIndex = 0;
+	long offset = 0;
+	int curWorker = 0;
+	char curLine[SIZE_RECORD+SIZE_EOL+1],prevLine[SIZE_RECORD+SIZE_EOL+1];
+
+	/*Account for header*/
+	totalSize -= SIZE_HEADER+SIZE_EOL;
+	sizeLeft -= SIZE_HEADER+SIZE_EOL;
+
+	/*Worker 1 always starts at beginning*/
+	index[0] = SIZE_HEADER+SIZE_EOL;
+
+	/*Calculate where in the file each worker should start their job*/
+	for (curWorker=0;curWorker<workerCount-1;curWorker++){		
+
+		approxIndex += sizeLeft/(workerCount-curWorker);  //Set to approximate index
+		approxIndex += (SIZE_RECORD+SIZE_EOL)-(approxIndex%(SIZE_RECORD+SIZE_EOL));  //Align index with a record in file
+
+		/*A long collision may have carried the last worker past the
+		approximate index, or past the end of the file*/
+		if (approxIndex < index[curWorker]-SIZE_HEADER-SIZE_EOL){
+			approxIndex = index[curWorker]-SIZE_HEADER-SIZE_EOL;
+		}
+		if (approxIndex+(SIZE_RECORD+SIZE_EOL) >= totalSize){
+			index[curWorker+1] = totalSize+SIZE_HEADER+SIZE_EOL;
+			continue;
+		}
+
+		/*Seek to approximate index*/
+		fseek(file,approxIndex+SIZE_HEADER+SIZE_EOL,SEEK_SET);
+
+		/*Read first two lines*/
+		fread((void*)prevLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file);
+		prevLine[SIZE_RECORD] = '\0';
+		fread((void*)curLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file);
+		curLine[SIZE_RECORD] = '\0';
+
+		offset = SIZE_RECORD+SIZE_EOL;
+		/*Calculate how many records ahead of approximate index 
+		are part of the same collision*/
+		while (!diffCol(prevLine,curLine)){
+			offset += SIZE_RECORD+SIZE_EOL;
+			strcpy(prevLine,curLine);
+
+			/*The end of the file ends the last collision*/
+			if (fread((void*)curLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file) != SIZE_RECORD+SIZE_EOL){
+				break;
+			}
+			curLine[SIZE_RECORD] = '\0';
+		}
+		index[curWorker+1] = approxIndex+offset+SIZE_HEADER+SIZE_EOL;       //Set workers index to last record of a collision
+		sizeLeft = totalSize-index[curWorker+1];              //Update the amount of work left
+	}
+
+	return index;
+}
+
+static inline int fieldValue(const char *field, int width){
+	int i, value = 0;
+	unsigned int digit;
+
+	for (i=0;i<width;i++){
+		digit = (unsigned char)field[i] - '0';
+		if (digit > 9){
+			break;
+		}
+		value = value*10 + digit;
+	}
+	return value;
+}
+
+static void getRecord(const char *line, Record *record){
+	/*Every record has the same width so each needed field
+	is read directly from its offset*/
+	record->date.year = fieldValue(line+OFF_CYEAR,4);
+	record->date.month = fieldValue(line+OFF_MNTH,2);
+	record->date.day = fieldValue(line+OFF_DAY,1);
+	record->death = (line[OFF_SEV] == '3');
+	record->vehNum = fieldValue(line+OFF_VEHN,2);
+	record->vehID = fieldValue(line+OFF_VID,2);
+	record->vehYear = fieldValue(line+OFF_VYEAR,4);  //0 if year is not provided in csv
+	record->gender = line[OFF_SEX];
+
+	if (line[OFF_LOC] == 'Q' && line[OFF_LOC+1] == 'Q'){
+		record->location = 0;
+	}
+	else if ( (record->location = fieldValue(line+OFF_LOC,2)) == 0){
+		record->location = -1;
+	}
+}
+static Dataset *partDataset(FILE *file, long startPos, long readLength){
+	Dataset *dataset = NULL;
+	int i,readCount,count;
+	char *block, prevLine[SIZE_RECORD+SIZE_EOL];
+
+	/*Go to provided address in file*/
+	if (fseek(file,startPos,SEEK_SET) == -1){
+		return NULL;
+	}
+
+	/*Calculate number of reads based on length provided*/
+	readCount = (readLength)/(SIZE_RECORD+SIZE_EOL);
+	createDataset(&dataset,readCount);
+	dataset->firstRecord = RECORD_AT(startPos);
+
+	block = malloc(CHUNK_RECORDS*(SIZE_RECORD+SIZE_EOL));
+
+	/*Read records from data file a chunk at a time*/
+	for (i=0; i<readCount; i+=count){
+		count = readCount-i < CHUNK_RECORDS ? readCount-i : CHUNK_RECORDS;
+		fread((void*)block,SIZE_RECORD+SIZE_EOL,count,file);
+
+		/*First record of the chunk is compared against the last
+		record of the previous chunk*/
+		addBlock(dataset, block, count, i > 0 ? prevLine : NULL, RECORD_AT(startPos)+i);
+		memcpy(prevLine, block+(count-1)*(SIZE_RECORD+SIZE_EOL), SIZE_RECORD+SIZE_EOL);
+	} 
+	free(block);
+	
+	return dataset;
+}
+
+static Dataset *bufferDataset(const char *buffer, long startPos, long readLength){
+	Dataset *dataset = NULL;
+	int readCount;
+
+	/*Calculate number of records based on length provided*/
+	readCount = (readLength)/(SIZE_RECORD+SIZE_EOL);
+	createDataset(&dataset,readCount);
+	dataset->firstRecord = RECORD_AT(startPos);
+
+	addBlock(dataset, buffer, readCount, NULL, RECORD_AT(startPos));
+
+	return dataset;
+}
+
+static void addBlock(Dataset *dataset, const char *block, int count, const char *prevLine, int firstRecord){
+	uint64_t bounds[CHUNK_RECORDS/64], word;
+	const char *line;
+	int i, j, size, low, high, first = recCount(dataset);
+
+	if (first+count > dataset->recCap){
+		reserveRecords(dataset,growCapacity(dataset->recCap,first+count));
+	}
+	decodeRecords(dataset, block, count);
+	trackYears(dataset, first, count);
+
+	if (sidecar != NULL){
+		/*Find the first collision starting in the block*/
+		low = 0;
+		high = sidecar->header.colNum;
+		while (low < high){
+			if (sidecar->starts[(low+high)/2] < firstRecord){ low = (low+high)/2+1; }
+			else{ high = (low+high)/2; }
+		}
+		for (i=low; i<sidecar->header.colNum && sidecar->starts[i] < firstRecord+count; i++){
+			dataset->colNum++;
+			addIndex(dataset, first+sidecar->starts[i]-firstRecord+1);
+		}
+		return;
+	}
+
+	/*The first record of a partition always starts a collision*/
+	for (i=0; i<count; i+=CHUNK_RECORDS){
+		size = count-i < CHUNK_RECORDS ? count-i : CHUNK_RECORDS;
+		line = block + i*(SIZE_RECORD+SIZE_EOL);
+		markBoundaries(line, size, i > 0 ? line-(SIZE_RECORD+SIZE_EOL) : prevLine, bounds);
+
+		for (j=0; j<(size+63)/64; j++){
+			for (word=bounds[j]; word != 0; word &= word-1){
+				dataset->colNum++;
+				addIndex(dataset, first+i+j*64+__builtin_ctzll(word)+1);
+			}
+		}
+	}
+}
+
+static void decodeScalar(Dataset *dataset, const char *records, int count){
+	Record record;
+	int i;
+
+	for (i=0; i<count; i++){
+		getRecord(records + i*(SIZE_RECORD+SIZE_EOL), &record);
+		addRecord(dataset, &record);
+	}
+}
+
+#ifdef HAVE_AVX2
+/*Value of the leading digits of the 1, 2 or 4 character field at the 
+bottom of each 32 bit lane, matching fieldValue*/
+__attribute__((target("avx2")))
+static inline __m256i lanesValue(__m256i raw, int width){
+	__m256i ten = _mm256_set1_epi32(10);
+	__m256i byte = _mm256_set1_epi32(0xFF);
+	__m256i digits = _mm256_sub_epi8(raw, _mm256_set1_epi8('0'));
+	__m256i digit, valid, prefix, value, result;
+	int i;
+
+	value = _mm256_and_si256(digits, byte);
+	prefix = _mm256_cmpgt_epi32(ten, value);
+	result = _mm256_and_si256(value, prefix);
+
+	/*A lane takes the longer value only while every character
+	so far has been a digit*/
+	for (i=1; i<width; i++){
+		digit = _mm256_and_si256(_mm256_srli_epi32(digits, 8*i), byte);
+		valid = _mm256_cmpgt_epi32(ten, digit);
+		prefix = _mm256_and_si256(prefix, valid);
+		value = _mm256_add_epi32(_mm256_mullo_epi32(value, ten), digit);
+		result = _mm256_blendv_epi8(result, value, prefix);
+	}
+	return result;
+}
+
+/*Narrows eight 32 bit lanes and stores them as shorts*/
+__attribute__((target("avx2")))
+static inline void storeShorts(short *column, __m256i lanes){
+	lanes = _mm256_packs_epi32(lanes, lanes);
+	lanes = _mm256_permute4x64_epi64(lanes, 0x08);
+	_mm_storeu_si128((__m128i*)column, _mm256_castsi256_si128(lanes));
+}
+
+/*Narrows eight 32 bit lanes and stores them as chars*/
+__attribute__((target("avx2")))
+static inline void storeChars(char *column, __m256i lanes){
+	__m128i low, high;
+
+	lanes = _mm256_packs_epi32(lanes, lanes);
+	lanes = _mm256_packs_epi16(lanes, lanes);
+	low = _mm256_castsi256_si128(lanes);
+	high = _mm256_extracti128_si256(lanes, 1);
+	_mm_storel_epi64((__m128i*)column, _mm_unpacklo_epi32(low, high));
+}
+
+__attribute__((target("avx2")))
+static void decodeAvx2(Dataset *dataset, const char *records, int count){
+	const int stride = SIZE_RECORD+SIZE_EOL;
+	__m256i offsets = _mm256_setr_epi32(0, stride, 2*stride, 3*stride, 4*stride, 5*stride, 6*stride, 7*stride);
+	__m256i byte = _mm256_set1_epi32(0xFF);
+	__m256i quotes = _mm256_set1_epi32('Q' | 'Q'<<8);
+	__m256i location, raw, isQQ;
+	const char *batch;
+	int i, j, died, first;
+
+	for (i=0; i+BATCH_RECORDS<=count; i+=BATCH_RECORDS){
+		batch = records + i*stride;
+		first = recCount(dataset);
+
+		/*Each gather pulls the same field out of eight records*/
+		#define GATHER(offset) _mm256_i32gather_epi32((const int*)(batch+(offset)), offsets, 1)
+		storeShorts(dataset->year+first, lanesValue(GATHER(OFF_CYEAR),4));
+		storeChars((char*)dataset->month+first, lanesValue(GATHER(OFF_MNTH),2));
+		storeChars((char*)dataset->day+first, lanesValue(GATHER(OFF_DAY),1));
+		storeChars((char*)dataset->vehNum+first, lanesValue(GATHER(OFF_VEHN),2));
+		storeChars((char*)dataset->vehID+first, lanesValue(GATHER(OFF_VID),2));
+		storeShorts(dataset->vehYear+first, lanesValue(GATHER(OFF_VYEAR),4));
+		storeChars(dataset->gender+first, _mm256_and_si256(GATHER(OFF_SEX), byte));
+
+		/*QQ locations are 0 and other non numeric ones are -1*/
+		raw = GATHER(OFF_LOC);
+		location = lanesValue(raw,2);
+		location = _mm256_or_si256(location, _mm256_cmpeq_epi32(location, _mm256_setzero_si256()));
+		isQQ = _mm256_cmpeq_epi32(_mm256_and_si256(raw, _mm256_set1_epi32(0xFFFF)), quotes);
+		storeChars((char*)dataset->location+first, _mm256_andnot_si256(isQQ, location));
+
+		died = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(
+			_mm256_and_si256(GATHER(OFF_SEV), byte), _mm256_set1_epi32('3'))));
+		#undef GATHER
+
+		for (j=0; j<BATCH_RECORDS; j++){
+			dataset->death[(first+j)/8] |= ((died >> j) & 1) << ((first+j)%8);
+		}
+		dataset->recNum += BATCH_RECORDS;
+	}
+
+	/*Records left over from the last batch*/
+	decodeScalar(dataset, records + i*stride, count-i);
+}
+#endif
+static Dataset *mapDataset(int fd, long startPos, long readLength){
+	Dataset *dataset;
+	char *map;
+	int offset;
+
+	/*Mappings must start on a page boundary*/
+	offset = startPos % sysconf(_SC_PAGESIZE);
+
+	map = mmap(NULL, readLength+offset, PROT_READ, MAP_PRIVATE, fd, startPos-offset);
+	if (map == MAP_FAILED){
+		return NULL;
+	}
+	madvise(map, readLength+offset, MADV_SEQUENTIAL);
+
+	dataset = bufferDataset(map+offset, startPos, readLength);
+	munmap(map, readLength+offset);
+
+	return dataset;
+}
+
+static Dataset *loadDataset(FILE *file, long startPos, long readLength){
+	Dataset *dataset = NULL;
+
+	if (readMode == READ_MMAP && readLength > 0){
+		dataset = mapDataset(fileno(file), startPos, readLength);
+	}
+	if (dataset == NULL){
+		dataset = partDataset(file, startPos, readLength);
+	}
+
+	return dataset;
+}
+
+static char *indexName(char *fileName){
+	char *name = malloc(strlen(fileName)+strlen(INDEX_SUFFIX)+1);
+
+	strcpy(name,fileName);
+	strcat(name,INDEX_SUFFIX);
+	return name;
+}
+
+static CollisionIndex *openIndex(char *fileName){
+	CollisionIndex *index;
+	struct stat info;
+	char *name;
+	FILE *file;
+
+	if (stat(fileName,&info) != 0){
+		return NULL;
+	}
+	name = indexName(fileName);
+	file = fopen(name,"rb");
+	free(name);
+	if (file == NULL){
+		return NULL;
+	}
+
+	index = malloc(sizeof(CollisionIndex));
+	index->starts = NULL;
+
+	/*The sidecar is stale once the data file changes*/
+	if (fread(&index->header,sizeof(IndexHeader),1,file) != 1
+		|| memcmp(index->header.magic,INDEX_MAGIC,sizeof(INDEX_MAGIC)) != 0
+		|| index->header.version != INDEX_VERSION
+		|| index->header.size != (long)info.st_size
+		|| index->header.mtime != (long)info.st_mtime){
+
+		fclose(file);
+		free(index);
+		return NULL;
+	}
+
+	index->starts = malloc(sizeof(int)*(index->header.colNum+1));
+	if (fread(index->starts,sizeof(int),index->header.colNum,file) != (size_t)index->header.colNum){
+		fclose(file);
+		free(index->starts);
+		free(index);
+		return NULL;
+	}
+	fclose(file);
+
+	return index;
+}
+
+static CollisionIndex *buildIndex(FILE *file, char *fileName){
+	CollisionIndex *index = malloc(sizeof(CollisionIndex));
+	uint64_t bounds[CHUNK_RECORDS/64], word;
+	struct stat info;
+	int i,j,readCount,count,capacity=0;
+	char *block, prevLine[SIZE_RECORD+SIZE_EOL], *name;
+	FILE *out;
+
+	memset(&index->header,0,sizeof(IndexHeader));
+	memcpy(index->header.magic,INDEX_MAGIC,sizeof(INDEX_MAGIC));
+	index->header.version = INDEX_VERSION;
+	index->starts = NULL;
+
+	readCount = countRecords(file);
+	fseek(file,SIZE_HEADER+SIZE_EOL,SEEK_SET);
+	block = malloc(CHUNK_RECORDS*(SIZE_RECORD+SIZE_EOL));
+
+	/*Compare every pair of neighbouring records once*/
+	for (i=0; i<readCount; i+=count){
+		count = readCount-i < CHUNK_RECORDS ? readCount-i : CHUNK_RECORDS;
+		fread((void*)block,SIZE_RECORD+SIZE_EOL,count,file);
+
+		markBoundaries(block, count, i > 0 ? prevLine : NULL, bounds);
+
+		for (j=0; j<(count+63)/64; j++){
+			for (word=bounds[j]; word != 0; word &= word-1){
+				if (index->header.colNum == capacity){
+					capacity = growCapacity(capacity,capacity+1);
+					index->starts = realloc(index->starts,sizeof(int)*capacity);
+				}
+				index->starts[index->header.colNum++] = i+j*64+__builtin_ctzll(word);
+			}
+		}
+		memcpy(prevLine, block+(count-1)*(SIZE_RECORD+SIZE_EOL), SIZE_RECORD+SIZE_EOL);
+	}
+	free(block);
+
+	/*Save the index for later runs, it is still used if this fails*/
+	if (stat(fileName,&info) == 0){
+		index->header.size = info.st_size;
+		index->header.mtime = info.st_mtime;
+
+		name = indexName(fileName);
+		if ( (out = fopen(name,"wb")) != NULL){
+			fwrite(&index->header,sizeof(IndexHeader),1,out);
+			fwrite(index->starts,sizeof(int),index->header.colNum,out);
+			fclose(out);
+		}
+		free(name);
+	}
+
+	return index;
+}
+
+static long *indexPositions(int workerCount){
+	long *index = malloc(sizeof(long)*workerCount);
+	int i,col;
+
+	for (i=0;i<workerCount;i++){
+		col = (long)sidecar->header.colNum*i/workerCount;
+		index[i] = SIZE_HEADER+SIZE_EOL + (long)(SIZE_RECORD+SIZE_EOL)*(col < sidecar->header.colNum ? sidecar->starts[col] : 0);
+	}
+	return index;
+}
+
+static bool convertFile(FILE *file, char *fileName, int splitNum){
+	Dataset *dataset;
+
+	if (binary != NULL){
+		printf("Error: File is already converted.\n");
+		return false;
+	}
+	if ( (dataset = loadDataset(file,SIZE_HEADER+SIZE_EOL,fileSize(file)-SIZE_HEADER-SIZE_EOL)) == NULL){
+		return false;
+	}
+	return writeBinary(fileName, dataset, splitNum);
+}
+
+static void binaryLayout(BinaryHeader *header, size_t *offset, size_t *size){
+	int i;
+
+	size[0] = sizeof(short)*header->recNum;
+	size[1] = size[2] = size[3] = size[4] = header->recNum;
+	size[5] = sizeof(short)*header->recNum;
+	size[6] = size[7] = header->recNum;
+	size[8] = (header->recNum+7)/8;
+	size[9] = sizeof(int)*header->colNum;
+
+	/*Split points follow the header and every array starts aligned*/
+	offset[0] = ALIGN8(sizeof(BinaryHeader)+sizeof(int)*header->splitNum);
+	for (i=0;i<BINARY_ARRAYS;i++){
+		offset[i+1] = ALIGN8(offset[i]+size[i]);
+	}
+}
+
+static BinaryHeader *readBinaryHeader(FILE *file){
+	BinaryHeader *header = malloc(sizeof(BinaryHeader));
+	size_t offset[BINARY_ARRAYS+1], size[BINARY_ARRAYS];
+
+	rewind(file);
+	if (fread(header,sizeof(BinaryHeader),1,file) != 1
+		|| memcmp(header->magic,BINARY_MAGIC,sizeof(BINARY_MAGIC)) != 0){
+		
+		free(header);
+		return NULL;
+	}
+	if (header->version != BINARY_VERSION || header->byteOrder != BINARY_ORDER){
+		printf("Error: Converted file has version %d and byte order %x, expected %d and %x.\n"
+			,header->version,header->byteOrder,BINARY_VERSION,BINARY_ORDER);
+		free(header);
+		return NULL;
+	}
+	binaryLayout(header,offset,size);
+	if (fileSize(file) < (long)offset[BINARY_ARRAYS]){
+		printf("Error: Converted file is truncated.\n");
+		free(header);
+		return NULL;
+	}
+	return header;
+}
+
+static bool writeBinary(char *fileName, Dataset *dataset, int splitNum){
+	BinaryHeader header;
+	FILE *file;
+	size_t offset[BINARY_ARRAYS+1], size[BINARY_ARRAYS];
+	const void *array[BINARY_ARRAYS];
+	int i,*splits,col=0;
+	bool written = true;
+
+	memset(&header,0,sizeof(BinaryHeader));
+	memcpy(header.magic,BINARY_MAGIC,sizeof(BINARY_MAGIC));
+	header.version = BINARY_VERSION;
+	header.byteOrder = BINARY_ORDER;
+	header.recNum = recCount(dataset);
+	header.colNum = colCount(dataset);
+	header.splitNum = splitNum;
+	binaryLayout(&header,offset,size);
+
+	/*First collision of each worker, balanced by records*/
+	splits = malloc(sizeof(int)*splitNum);
+	for (i=0;i<splitNum;i++){
+		while (col < colCount(dataset) && dataset->collisionIndex[col] < (long)recCount(dataset)*i/splitNum){
+			col++;
+		}
+		splits[i] = col;
+	}
+
+	array[0] = dataset->year;
+	array[1] = dataset->month;
+	array[2] = dataset->day;
+	array[3] = dataset->location;
+	array[4] = dataset->gender;
+	array[5] = dataset->vehYear;
+	array[6] = dataset->vehNum;
+	array[7] = dataset->vehID;
+	array[8] = dataset->death;
+	array[9] = dataset->collisionIndex;
+
+	if ( (file = fopen(fileName,"wb")) == NULL){
+		free(splits);
+		return false;
+	}
+	written &= fwrite(&header,sizeof(BinaryHeader),1,file) == 1;
+	written &= fwrite(splits,sizeof(int),splitNum,file) == (size_t)splitNum;
+	for (i=0;i<BINARY_ARRAYS && written;i++){
+		written &= fseek(file,offset[i],SEEK_SET) == 0;
+		written &= fwrite(array[i],1,size[i],file) == size[i];
+	}
+	/*Pad the last array so the file covers the whole layout*/
+	while (written && ftell(file) < (long)offset[BINARY_ARRAYS]){
+		written &= fputc(0,file) != EOF;
+	}
+	free(splits);
+
+	return (fclose(file) == 0) && written;
+}
+
+static long *binaryPositions(FILE *file, int workerCount){
+	long *index = malloc(sizeof(long)*workerCount);
+	int *collisionIndex;
+	size_t offset[BINARY_ARRAYS+1], size[BINARY_ARRAYS];
+	int i,col=0;
+
+	/*Use the split points recorded at conversion when they fit*/
+	if (binary->splitNum == workerCount){
+		collisionIndex = malloc(sizeof(int)*workerCount);
+		fseek(file,sizeof(BinaryHeader),SEEK_SET);
+		fread(collisionIndex,sizeof(int),workerCount,file);
+		for (i=0;i<workerCount;i++){
+			index[i] = collisionIndex[i];
+		}
+		free(collisionIndex);
+		return index;
+	}
+
+	binaryLayout(binary,offset,size);
+	collisionIndex = malloc(sizeof(int)*binary->colNum);
+	fseek(file,offset[9],SEEK_SET);
+	fread(collisionIndex,sizeof(int),binary->colNum,file);
+
+	for (i=0;i<workerCount;i++){
+		while (col < binary->colNum && collisionIndex[col] < (long)binary->recNum*i/workerCount){
+			col++;
+		}
+		index[i] = col;
+	}
+	free(collisionIndex);
+
+	return index;
+}
+
+static const char *mapRange(Dataset *dataset, int fd, size_t offset, size_t length){
+	char *map;
+	size_t page = offset % sysconf(_SC_PAGESIZE);
+
+	/*Mappings must start on a page boundary and hold a byte*/
+	map = mmap(NULL, length+page+1, PROT_READ, MAP_PRIVATE, fd, offset-page);
+	if (map == MAP_FAILED){
+		return NULL;
+	}
+	dataset->maps[dataset->mapNum] = map;
+	dataset->mapSizes[dataset->mapNum++] = length+page+1;
+
+	return map+page;
+}
+
+static Dataset *mapBinary(int fd, int firstCol, int colLength){
+	Dataset *dataset;
+	size_t offset[BINARY_ARRAYS+1], size[BINARY_ARRAYS];
+	const char *column[BINARY_ARRAYS-2];
+	const int *collisionIndex;
+	const unsigned char *death;
+	int i,first,last,width,indexNum;
+
+	binaryLayout(binary,offset,size);
+	createDataset(&dataset,0);
+
+	/*The index of the collision after the range tells where its
+	records end*/
+	indexNum = (firstCol+colLength < binary->colNum) ? colLength+1 : colLength;
+	collisionIndex = (const int*)mapRange(dataset, fd, offset[9]+sizeof(int)*firstCol, sizeof(int)*indexNum);
+	if (collisionIndex == NULL){
+		freeDataset(dataset);
+		return NULL;
+	}
+	first = (firstCol < binary->colNum) ? collisionIndex[0] : binary->recNum;
+	last = (firstCol+colLength < binary->colNum) ? collisionIndex[colLength] : binary->recNum;
+
+	for (i=0;i<BINARY_ARRAYS-2;i++){
+		width = (i == 0 || i == 5) ? sizeof(short) : 1;
+		if ( (column[i] = mapRange(dataset, fd, offset[i]+(size_t)width*first, (size_t)width*(last-first))) == NULL){
+			freeDataset(dataset);
+			return NULL;
+		}
+	}
+	if ( (death = (const unsigned char*)mapRange(dataset, fd, offset[8]+first/8, (last+7)/8-first/8)) == NULL){
+		freeDataset(dataset);
+		return NULL;
+	}
+
+	dataset->recNum = dataset->recCap = last-first;
+	dataset->firstRecord = first;
+	dataset->year = (short*)column[0];
+	dataset->month = (signed char*)column[1];
+	dataset->day = (signed char*)column[2];
+	dataset->location = (signed char*)column[3];
+	dataset->gender = (char*)column[4];
+	dataset->vehYear = (short*)column[5];
+	dataset->vehNum = (signed char*)column[6];
+	dataset->vehID = (signed char*)column[7];
+	trackYears(dataset, 0, dataset->recNum);
+
+	/*Deaths and collision indexes are relative to the first record*/
+	dataset->death = arenaAlloc(dataset->arena,(dataset->recNum+7)/8+1);
+	memset(dataset->death,0,(dataset->recNum+7)/8+1);
+	for (i=0;i<dataset->recNum;i++){
+		dataset->death[i/8] |= ((death[(first%8+i)/8] >> ((first+i)%8)) & 1) << (i%8);
+	}
+	reserveIndexes(dataset,colLength+1);
+	dataset->colNum = colLength;
+	for (i=0;i<colLength;i++){
+		dataset->collisionIndex[i] = collisionIndex[i]-first;
+	}
+
+	return dataset;
+}
+
+static long readLength(int workerNum, int workerCount, long position[], long fileSize){
+	/*Get length of partition*/
+	if (workerNum != (workerCount-1)){
+    	return position[workerNum+1]-position[workerNum]; 
+	}		
+	else{
+		return fileSize-position[workerNum];
+	}		
+}
+
+WorstMonth *findMax(Aggregates *agg){
+	int i,j,index=0,max=0;
+	int maxF=0,indexF=0,maxFAll=0,maxAllF=0,maxAll=0;
+	int indexYear=0,indexMonth=0;
+	int months[12][2];
+	int *arr = agg->tally;
+	WorstMonth *worst;
+
+	/*The worst month of each year follows in the same allocation*/
+	worst = malloc(sizeof(WorstMonth)+sizeof(Date)*2*agg->yearNum);
+	worst->yearNum = agg->yearNum;
+	worst->fatal = (Date*)(worst+1);
+	worst->nonFatal = worst->fatal+agg->yearNum;
+
+	for (i=0;i<12;i++){
+		months[i][0] = 0;
+		months[i][1] = 0;
+	}
+	
+	for (j=0;j<agg->yearNum;j++){
+		max = 0;
+		maxF = 0;
+		worst->nonFatal[j].year = worst->fatal[j].year = j+agg->firstYear;
+		worst->nonFatal[j].month = worst->fatal[j].month = 0;
+		for (i=0;i<12;i++){
+			/*Check for worst non fatal injury month*/
+			if (arr[TALLY(j,i,0)] > max){
+				worst->nonFatal[j].month = i+1;
+				max = arr[TALLY(j,i,0)];
+			}
+			/*Check for worst fatal injury month*/
+			if (arr[TALLY(j,i,1)] > maxF){
+				worst->fatal[j].month = i+1;
+				maxF = arr[TALLY(j,i,1)];
+			}	
+			/*Total all months*/
+			months[i][0] += arr[TALLY(j,i,0)];
+			months[i][1] += arr[TALLY(j,i,1)];
+		}
+	}
+
+	/*Find worst month total*/
+	max = maxF = 0;
+	for (i=0;i<12;i++){
+		if (months[i][0] > max){
+			max = months[i][0];
+			index = i;
+		}
+		if (months[i][1] > maxF){
+			maxF = months[i][1];
+			indexF = i;
+		}
+	}
+	worst->total.month = index+1;
+	worst->totalF.month = indexF+1;	
+
+	return worst;
+}
+
+void mostVehicles(Dataset *dataset, int first, MostVehicles *mostVeh){
+	if (dataset->vehNum[first] > mostVeh->total){
+		mostVeh->total = dataset->vehNum[first];
+		mostVeh->date.year = dataset->year[first];
+		mostVeh->date.month = dataset->month[first];
+		mostVeh->date.day = dataset->day[first];
+		mostVeh->record = dataset->firstRecord+first;
+	}	
+}
+
+void countNewWrecks(Dataset *dataset, int first, int last, NewWreckedCars *newWrecks){
+	uint64_t newSeen[2] = {0,0}, ageSeen[2] = {0,0};
+	uint64_t bit;
+	int j,id;
+
+	/*Each vehicle of the collision is counted once, vehicle ids
+	fit in a signed char so two words hold every id seen*/
+	for (j=first;j<last;j++){
+		id = dataset->vehID[j];
+		if (id <= 0 || id == 99){
+			continue;
+		}
+		bit = (uint64_t)1 << (id & 63);
+
+		if (!(newSeen[id >> 6] & bit) && (dataset->vehYear[j] > 0) 
+			&& (dataset->vehYear[j] >= dataset->year[j])){	
+			newWrecks->newVehiclesInvolved++;
+			newSeen[id >> 6] |= bit;
+		}
+		if (!(ageSeen[id >> 6] & bit) && (dataset->vehYear[j] > 1000)) {
+			newWrecks->vehicleAgeTotal += dataset->year[j] - dataset->vehYear[j] + 1;
+			newWrecks->vehiclesInvolved ++;
+			ageSeen[id >> 6] |= bit;
+		}	
+	}
+}
+
+static void createAggregates(Aggregates **agg, int queries){
+	Arena *arena;
+	int i;
+
+	createArena(&arena, ARENA_MIN);
+	*agg = arenaAlloc(arena, sizeof(Aggregates));
+	(*agg)->arena = arena;
+	(*agg)->queries = queries;
+	(*agg)->recNum = 0;
+	(*agg)->colNum = 0;
+
+	/*The tally covers no years until some are seen, it still
+	has an address so it can be sent empty*/
+	(*agg)->firstYear = 0;
+	(*agg)->yearNum = 0;
+	(*agg)->tally = arenaAlloc(arena, 0);
+	(*agg)->monthCells = NULL;
+	(*agg)->killed[0] = 0;
+	(*agg)->killed[1] = 0;
+	(*agg)->mostVeh.total = 0;
+	(*agg)->mostVeh.record = INT_MAX;
+	(*agg)->mostVeh.date.year = 0;
+	(*agg)->mostVeh.date.month = 0;
+	(*agg)->mostVeh.date.day = 0;
+	(*agg)->wrecks.newVehiclesInvolved = 0;
+	(*agg)->wrecks.vehicleAgeTotal = 0;
+	(*agg)->wrecks.vehiclesInvolved = 0;
+	for (i=0;i<13;i++){ (*agg)->locs[i] = 0; }
+	(*agg)->cube = NULL;
+	(*agg)->adhocNum = 0;
+	(*agg)->adhoc = NULL;
+	(*agg)->cells = NULL;
+}
+
+static int queryMask(int *queries, int queryCount){
+	int i, mask = 0;
+
+	for (i=0;i<queryCount;i++){
+		if (queries[i] >= 1 && queries[i] <= 5){
+			mask |= 1 << queries[i];
+		}
+	}
+	return mask;
+}
+
+static void growTally(Aggregates *agg, int firstYear, int lastYear){
+	int *tally;
+
+	if (agg->yearNum > 0){
+		firstYear = firstYear < agg->firstYear ? firstYear : agg->firstYear;
+		lastYear = lastYear > agg->firstYear+agg->yearNum-1 ? lastYear : agg->firstYear+agg->yearNum-1;
+		if (firstYear == agg->firstYear && lastYear-firstYear+1 == agg->yearNum){
+			return;
+		}
+	}
+
+	/*The old tally is left in the arena, it only moves when a
+	partition holds years the others did not*/
+	tally = arenaAlloc(agg->arena, sizeof(int)*TALLY(lastYear-firstYear+1,0,0));
+	memset(tally, 0, sizeof(int)*TALLY(lastYear-firstYear+1,0,0));
+	if (agg->yearNum > 0){
+		memcpy(tally+TALLY(agg->firstYear-firstYear,0,0), agg->tally, sizeof(int)*TALLY(agg->yearNum,0,0));
+	}
+	agg->tally = tally;
+	agg->firstYear = firstYear;
+	agg->yearNum = lastYear-firstYear+1;
+
+	/*Years and months each have a group for other values*/
+	agg->monthCells = arenaAlloc(agg->arena, sizeof(long long)*2*(agg->yearNum+1)*(12+1));
+}
+
+static void addTally(Aggregates *agg, int firstYear, int yearNum, const int *tally){
+	int i, offset;
+
+	if (yearNum <= 0){
+		return;
+	}
+	growTally(agg, firstYear, firstYear+yearNum-1);
+
+	offset = TALLY(firstYear-agg->firstYear,0,0);
+	for (i=0;i<TALLY(yearNum,0,0);i++){
+		agg->tally[offset+i] += tally[i];
+	}
+}
+
+static void trackYears(Dataset *dataset, int first, int count){
+	int i, year;
+
+	for (i=first;i<first+count;i++){
+		year = dataset->year[i];
+		if (year > 0){
+			dataset->minYear = year < dataset->minYear ? year : dataset->minYear;
+			dataset->maxYear = year > dataset->maxYear ? year : dataset->maxYear;
+		}
+	}
+}
+
+static void foldCollisions(Dataset *dataset, int from, int to, Aggregates *agg){
+	GroupQuery month[2];
+	GroupRun *runs;
+	GroupBlock records, collisions;
+	int recRows[GROUP_BLOCK], colRows[GROUP_BLOCK];
+	long long killed[BUILTIN_CELLS], locs[BUILTIN_CELLS];
+	int i,k,col,first,last,end,runNum;
+	double start;
+
+	if (from >= to){
+		return;
+	}
+	start = profStart(PROF_QUERIES);
+
+	runs = malloc(sizeof(GroupRun)*(4+agg->adhocNum));
+	records.rows = recRows;
+	collisions.rows = colRows;
+	runNum = planQueries(dataset, agg, month, killed, locs, runs);
+	if (agg->cube != NULL && dataset->minYear <= dataset->maxYear){
+		growCube(agg->cube, dataset->minYear, dataset->maxYear);
+	}
+
+	/*Blocks of records are taken in order, each with the collisions
+	starting in it, so every query sees a block while it is in cache
+	and columns are loaded once for all of them*/
+	end = (to != colCount(dataset)) ? dataset->collisionIndex[to] : recCount(dataset);
+	col = from;
+	for (i=dataset->collisionIndex[from];i<end;i+=records.count){
+		records.count = (end-i < GROUP_BLOCK) ? end-i : GROUP_BLOCK;
+		collisions.count = 0;
+		records.loaded = collisions.loaded = 0;
+		for (k=0;k<records.count;k++){
+			recRows[k] = i+k;
+		}
+
+		/*The records of the last collision may run into the next block*/
+		for (;col<to && dataset->collisionIndex[col] < i+records.count;col++){
+			first = dataset->collisionIndex[col];
+			last = (col != dataset->colNum-1) ? dataset->collisionIndex[col+1] : dataset->recNum;
+			colRows[collisions.count++] = first;
+
+			if (agg->queries & 1<<3){ mostVehicles(dataset, first, &agg->mostVeh); }
+			if (agg->queries & 1<<4){ countNewWrecks(dataset, first, last, &agg->wrecks); }
+			if (agg->cube != NULL){ addToCube(dataset, first, last, agg->cube); }
+
+			agg->recNum += last-first;
+			agg->colNum++;
+		}
+
+		for (k=0;k<runNum;k++){
+			runBlock(dataset, (runs[k].query->level == LEVEL_RECORDS) ? &records : &collisions, runs[k].query, runs[k].cells);
+		}
+	}
+
+	foldQueries(dataset, agg, killed, locs);
+	free(runs);
+	profEnd(PROF_QUERIES, start);
+}
+
+static int groupCells(const GroupQuery *query){
+	int i, cells = 1;
+
+	/*Each column has one more group for values out of its range*/
+	for (i=0;i<query->groupNum;i++){
+		cells *= query->groupSpan[i]+1;
+	}
+	return cells;
+}
+
+static void clearCells(const GroupQuery *query, long long *cells){
+	int i, size = groupCells(query);
+	int identity = (query->func == AGG_MIN) ? INT_MAX : (query->func == AGG_MAX) ? INT_MIN : 0;
+
+	for (i=0;i<size;i++){
+		cells[i] = identity;
+	}
+}
+
+static void mergeCells(const GroupQuery *query, long long *cells, const long long *next){
+	int i, size = groupCells(query);
+
+	for (i=0;i<size;i++){
+		switch(query->func){
+			case AGG_MIN:
+				cells[i] = next[i] < cells[i] ? next[i] : cells[i];
+				break;
+			case AGG_MAX:
+				cells[i] = next[i] > cells[i] ? next[i] : cells[i];
+				break;
+			default:
+				cells[i] += next[i];
+				break;
+		}
+	}
+}
+
+static void loadColumn(Dataset *dataset, int column, const int *rows, int count, int *values){
+	int i;
+
+	/*The column is chosen once for the whole block*/
+	switch(column){
+		case COL_YEAR:
+			for (i=0;i<count;i++){ values[i] = dataset->year[rows[i]]; }
+			break;
+		case COL_MONTH:
+			for (i=0;i<count;i++){ values[i] = dataset->month[rows[i]]; }
+			break;
+		case COL_DAY:
+			for (i=0;i<count;i++){ values[i] = dataset->day[rows[i]]; }
+			break;
+		case COL_LOCATION:
+			for (i=0;i<count;i++){ values[i] = dataset->location[rows[i]]; }
+			break;
+		case COL_GENDER:
+			for (i=0;i<count;i++){ values[i] = dataset->gender[rows[i]]; }
+			break;
+		case COL_VEHYEAR:
+			for (i=0;i<count;i++){ values[i] = dataset->vehYear[rows[i]]; }
+			break;
+		case COL_VEHNUM:
+			for (i=0;i<count;i++){ values[i] = dataset->vehNum[rows[i]]; }
+			break;
+		case COL_VEHID:
+			for (i=0;i<count;i++){ values[i] = dataset->vehID[rows[i]]; }
+			break;
+		case COL_DEATH:
+			for (i=0;i<count;i++){ values[i] = DIED(dataset,rows[i]); }
+			break;
+	}
+}
+
+static void filterBlock(int op, int value, const int *values, int count, unsigned char *keep){
+	int i;
+
+	switch(op){
+		case OP_EQ:
+			for (i=0;i<count;i++){ keep[i] &= values[i] == value; }
+			break;
+		case OP_NE:
+			for (i=0;i<count;i++){ keep[i] &= values[i] != value; }
+			break;
+		case OP_LT:
+			for (i=0;i<count;i++){ keep[i] &= values[i] < value; }
+			break;
+		case OP_LE:
+			for (i=0;i<count;i++){ keep[i] &= values[i] <= value; }
+			break;
+		case OP_GT:
+			for (i=0;i<count;i++){ keep[i] &= values[i] > value; }
+			break;
+		case OP_GE:
+			for (i=0;i<count;i++){ keep[i] &= values[i] >= value; }
+			break;
+	}
+}
+
+static const int *blockColumn(Dataset *dataset, GroupBlock *block, int column){
+	if (!(block->loaded & 1u<<column)){
+		loadColumn(dataset, column, block->rows, block->count, block->values[column]);
+		block->loaded |= 1u<<column;
+	}
+	return block->values[column];
+}
+
+static void runBlock(Dataset *dataset, GroupBlock *block, const GroupQuery *query, long long *cells){
+	int keys[GROUP_BLOCK];
+	unsigned char keep[GROUP_BLOCK];
+	const int *values;
+	int j,k,slot,span,count = block->count;
+
+	for (j=0;j<count;j++){
+		keep[j] = 1;
+		keys[j] = 0;
+	}
+
+	for (k=0;k<query->filterNum;k++){
+		values = blockColumn(dataset, block, query->filterCol[k]);
+		filterBlock(query->filterOp[k], query->filterValue[k], values, count, keep);
+	}
+
+	/*Values out of range of a column share its last group*/
+	for (k=0;k<query->groupNum;k++){
+		values = blockColumn(dataset, block, query->groupCol[k]);
+		span = query->groupSpan[k];
+		for (j=0;j<count;j++){
+			slot = values[j]-query->groupMin[k];
+			keys[j] = keys[j]*(span+1) + ((unsigned)slot < (unsigned)span ? slot : span);
+		}
+	}
+
+	switch(query->func){
+		case AGG_COUNT:
+			for (j=0;j<count;j++){ cells[keys[j]] += keep[j]; }
+			break;
+		case AGG_SUM:
+			values = blockColumn(dataset, block, query->column);
+			for (j=0;j<count;j++){ cells[keys[j]] += keep[j] * (long long)values[j]; }
+			break;
+		case AGG_MIN:
+			values = blockColumn(dataset, block, query->column);
+			for (j=0;j<count;j++){
+				if (keep[j] && values[j] < cells[keys[j]]){ cells[keys[j]] = values[j]; }
+			}
+			break;
+		case AGG_MAX:
+			values = blockColumn(dataset, block, query->column);
+			for (j=0;j<count;j++){
+				if (keep[j] && values[j] > cells[keys[j]]){ cells[keys[j]] = values[j]; }
+			}
+			break;
+	}
+}
+
+static int planQueries(Dataset *dataset, Aggregates *agg, GroupQuery *month, long long *killed, long long *locs, GroupRun *runs){
+	int i,k,runNum = 0;
+
+	/*Collisions and deaths each month of every year in the data*/
+	if (agg->queries & 1<<1 && dataset->minYear <= dataset->maxYear){
+		growTally(agg, dataset->minYear, dataset->maxYear);
+		for (k=0;k<2;k++){
+			month[k] = (k == 0) ? monthQuery : monthDeathQuery;
+			month[k].groupMin[0] = agg->firstYear;
+			month[k].groupSpan[0] = agg->yearNum;
+
+			runs[runNum].query = &month[k];
+			runs[runNum].cells = agg->monthCells+k*groupCells(&month[k]);
+			clearCells(&month[k], runs[runNum++].cells);
+		}
+	}
+	/*Men and women killed*/
+	if (agg->queries & 1<<2){
+		runs[runNum].query = &killedQuery;
+		runs[runNum].cells = killed;
+		clearCells(&killedQuery, runs[runNum++].cells);
+	}
+	/*Collisions at each location*/
+	if (agg->queries & 1<<5){
+		runs[runNum].query = &locationQuery;
+		runs[runNum].cells = locs;
+		clearCells(&locationQuery, runs[runNum++].cells);
+	}
+
+	/*Ad-hoc tables are added to as they are*/
+	for (i=0;i<agg->adhocNum;i++){
+		runs[runNum].query = &agg->adhoc[i];
+		runs[runNum++].cells = agg->cells[i];
+	}
+	return runNum;
+}
+
+static void foldQueries(Dataset *dataset, Aggregates *agg, const long long *killed, const long long *locs){
+	int i,j,k;
+
+	if (agg->queries & 1<<1 && dataset->minYear <= dataset->maxYear){
+		for (k=0;k<2;k++){
+			for (i=0;i<agg->yearNum;i++){
+				for (j=0;j<12;j++){ agg->tally[TALLY(i,j,k)] += agg->monthCells[k*(agg->yearNum+1)*13+i*13+j]; }
+			}
+		}
+	}
+	if (agg->queries & 1<<2){
+		agg->killed[0] += killed['M'-'A'];
+		agg->killed[1] += killed['F'-'A'];
+	}
+	if (agg->queries & 1<<5){
+		for (i=0;i<13;i++){ agg->locs[i] += locs[i]; }
+	}
+}
+
+static void addAdhoc(Aggregates *agg, GroupQuery *adhoc, int adhocNum){
+	int i;
+
+	agg->adhocNum = adhocNum;
+	agg->adhoc = adhoc;
+	agg->cells = arenaAlloc(agg->arena, sizeof(long long*)*adhocNum);
+	for (i=0;i<adhocNum;i++){
+		agg->cells[i] = arenaAlloc(agg->arena, sizeof(long long)*groupCells(&adhoc[i]));
+		clearCells(&adhoc[i], agg->cells[i]);
+	}
+}
+
+static int columnNumber(const char *name){
+	int i;
+
+	for (i=0;i<COLUMNS;i++){
+		if (strcmp(name,columnNames[i]) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool parseGroupQuery(char *spec, GroupQuery *query){
+	char *term, *item, *value, *func, *termEnd, *itemEnd;
+	int column,op,cells = 1;
+
+	memset(query, 0, sizeof(GroupQuery));
+	query->level = LEVEL_RECORDS;
+	query->func = AGG_COUNT;
+
+	for (term=strtok_r(spec," \t\n",&termEnd); term != NULL; term=strtok_r(NULL," \t\n",&termEnd)){
+		if (strncmp(term,"by=",3) == 0){
+			for (item=strtok_r(term+3,",",&itemEnd); item != NULL; item=strtok_r(NULL,",",&itemEnd)){
+				if (query->groupNum == GROUP_KEYS || (column = columnNumber(item)) < 0){
+					return false;
+				}
+				query->groupCol[query->groupNum] = column;
+				query->groupMin[query->groupNum] = columnMin[column];
+				query->groupSpan[query->groupNum++] = columnSpan[column];
+				cells *= columnSpan[column]+1;
+			}
+		}
+		else if (strncmp(term,"where=",6) == 0){
+			for (item=strtok_r(term+6,",",&itemEnd); item != NULL; item=strtok_r(NULL,",",&itemEnd)){
+				/*The column name ends where the comparison starts*/
+				value = item + strcspn(item,"=!<>");
+				if (*value == '\0' || query->filterNum == GROUP_FILTERS){
+					return false;
+				}
+				if (value[0] == '!' && value[1] == '='){ op = OP_NE; }
+				else if (value[0] == '<' && value[1] == '='){ op = OP_LE; }
+				else if (value[0] == '>' && value[1] == '='){ op = OP_GE; }
+				else if (value[0] == '<'){ op = OP_LT; }
+				else if (value[0] == '>'){ op = OP_GT; }
+				else if (value[0] == '='){ op = OP_EQ; }
+				else { return false; }
+				func = value + ((op == OP_LT || op == OP_GT || op == OP_EQ) ? 1 : 2);
+				*value = '\0';
+				if ( (column = columnNumber(item)) < 0 || *func == '\0'){
+					return false;
+				}
+
+				query->filterCol[query->filterNum] = column;
+				query->filterOp[query->filterNum] = op;
+				/*Genders are compared by letter*/
+				query->filterValue[query->filterNum] = (column == COL_GENDER) ? *func : strtol(func,NULL,10);
+				query->filterNum++;
+			}
+		}
+		else if (strncmp(term,"agg=",4) == 0){
+			func = term+4;
+			if ( (value = strchr(func,':')) != NULL){
+				*value++ = '\0';
+				if ( (query->column = columnNumber(value)) < 0){
+					return false;
+				}
+			}
+			if (strcmp(func,"count") == 0){ query->func = AGG_COUNT; }
+			else if (strcmp(func,"sum") == 0){ query->func = AGG_SUM; }
+			else if (strcmp(func,"min") == 0){ query->func = AGG_MIN; }
+			else if (strcmp(func,"max") == 0){ query->func = AGG_MAX; }
+			else { return false; }
+			if (query->func != AGG_COUNT && value == NULL){
+				return false;
+			}
+		}
+		else if (strcmp(term,"level=records") == 0){
+			query->level = LEVEL_RECORDS;
+		}
+		else if (strcmp(term,"level=collisions") == 0){
+			query->level = LEVEL_COLLISIONS;
+		}
+		else{
+			return false;
+		}
+	}
+
+	return cells <= GROUP_CELLS;
+}
+
+static void printGroupQuery(int number, const GroupQuery *query, const long long *cells){
+	int i,k,key,slot[GROUP_KEYS],size = groupCells(query);
+	int empty = (query->func == AGG_MIN) ? INT_MAX : (query->func == AGG_MAX) ? INT_MIN : 0;
+
+	for (i=0;i<size;i++){
+		if (cells[i] == empty){
+			continue;
+		}
+
+		/*Undo the mixed radix key of the group*/
+		key = i;
+		for (k=query->groupNum-1;k>=0;k--){
+			slot[k] = key % (query->groupSpan[k]+1);
+			key /= query->groupSpan[k]+1;
+		}
+
+		fprintf(answerOut,"$G%d",number);
+		for (k=0;k<query->groupNum;k++){
+			if (slot[k] == query->groupSpan[k]){
+				fprintf(answerOut,",other");
+			}
+			else if (query->groupCol[k] == COL_GENDER){
+				fprintf(answerOut,",%c",query->groupMin[k]+slot[k]);
+			}
+			else{
+				fprintf(answerOut,",%d",query->groupMin[k]+slot[k]);
+			}
+		}
+		fprintf(answerOut,",%lld\n",cells[i]);
+	}
+}
+
+static void createCube(Cube **cube){
+	*cube = calloc(1,sizeof(Cube));
+	(*cube)->coll = calloc(CUBE_COLL(1,0,0),sizeof(int));
+	(*cube)->deaths = calloc(CUBE_DEATHS(1,0,0),sizeof(int));
+}
+
+static void freeCube(Cube *cube){
+	if (cube == NULL){
+		return;
+	}
+	free(cube->coll);
+	free(cube->deaths);
+	free(cube);
+}
+
+static void growCube(Cube *cube, int firstYear, int lastYear){
+	int *coll, *deaths;
+	int yearNum;
+
+	if (cube->yearNum > 0){
+		firstYear = firstYear < cube->firstYear ? firstYear : cube->firstYear;
+		lastYear = lastYear > cube->firstYear+cube->yearNum-1 ? lastYear : cube->firstYear+cube->yearNum-1;
+		if (firstYear == cube->firstYear && lastYear-firstYear+1 == cube->yearNum){
+			return;
+		}
+	}
+	yearNum = lastYear-firstYear+1;
+	coll = calloc(CUBE_COLL(yearNum+1,0,0),sizeof(int));
+	deaths = calloc(CUBE_DEATHS(yearNum+1,0,0),sizeof(int));
+
+	/*Years move to their new slots, the slot of other years stays last*/
+	if (cube->yearNum > 0){
+		memcpy(coll+CUBE_COLL(cube->firstYear-firstYear,0,0), cube->coll, sizeof(int)*CUBE_COLL(cube->yearNum,0,0));
+		memcpy(deaths+CUBE_DEATHS(cube->firstYear-firstYear,0,0), cube->deaths, sizeof(int)*CUBE_DEATHS(cube->yearNum,0,0));
+	}
+	memcpy(coll+CUBE_COLL(yearNum,0,0), cube->coll+CUBE_COLL(cube->yearNum,0,0), sizeof(int)*CUBE_COLL(1,0,0));
+	memcpy(deaths+CUBE_DEATHS(yearNum,0,0), cube->deaths+CUBE_DEATHS(cube->yearNum,0,0), sizeof(int)*CUBE_DEATHS(1,0,0));
+
+	free(cube->coll);
+	free(cube->deaths);
+	cube->coll = coll;
+	cube->deaths = deaths;
+	cube->firstYear = firstYear;
+	cube->yearNum = yearNum;
+}
+
+static void addToCube(Dataset *dataset, int first, int last, Cube *cube){
+	int i,year,month,location,gender,vehicles;
+
+	/*Years, months and locations outside the range share a slot*/
+	year = dataset->year[first]-cube->firstYear;
+	year = ((unsigned)year < (unsigned)cube->yearNum) ? year : cube->yearNum;
+	month = (dataset->month[first] >= 1 && dataset->month[first] <= 12) ? dataset->month[first]-1 : CUBE_MONTHS-1;
+	location = (dataset->location[first] >= 0 && dataset->location[first] < CUBE_LOCS-1) ? dataset->location[first] : CUBE_LOCS-1;
+	cube->coll[CUBE_COLL(year,month,location)]++;
+
+	vehicles = dataset->vehNum[first];
+	if (vehicles >= 0 && vehicles < CUBE_VEHS && cube->vehCount[vehicles]++ == 0){
+		cube->vehFirst[vehicles].year = dataset->year[first];
+		cube->vehFirst[vehicles].month = dataset->month[first];
+		cube->vehFirst[vehicles].day = dataset->day[first];
+		cube->vehRecord[vehicles] = dataset->firstRecord+first;
+	}
+
+	for (i=first;i<last;i++){
+		if (DIED(dataset,i)){
+			gender = (dataset->gender[i] == 'M') ? 0 : (dataset->gender[i] == 'F') ? 1 : 2;
+			cube->deaths[CUBE_DEATHS(year,month,gender)]++;
+		}
+	}
+}
+
+static void mergeCube(Cube *cube, Cube *next){
+	int i,j,year;
+
+	if (next->yearNum > 0){
+		growCube(cube, next->firstYear, next->firstYear+next->yearNum-1);
+	}
+
+	/*The last slot of each holds the other years*/
+	for (i=0;i<=next->yearNum;i++){
+		year = (i < next->yearNum) ? next->firstYear+i-cube->firstYear : cube->yearNum;
+		for (j=0;j<CUBE_COLL(1,0,0);j++){ cube->coll[CUBE_COLL(year,0,j)] += next->coll[CUBE_COLL(i,0,j)]; }
+		for (j=0;j<CUBE_DEATHS(1,0,0);j++){ cube->deaths[CUBE_DEATHS(year,0,j)] += next->deaths[CUBE_DEATHS(i,0,j)]; }
+	}
+
+	/*The earliest collision in the file is kept, partitions
+	handed out as chunks need not arrive in order*/
+	for (i=0;i<CUBE_VEHS;i++){
+		if (next->vehCount[i] > 0 && (cube->vehCount[i] == 0 || next->vehRecord[i] < cube->vehRecord[i])){
+			cube->vehFirst[i] = next->vehFirst[i];
+			cube->vehRecord[i] = next->vehRecord[i];
+		}
+		cube->vehCount[i] += next->vehCount[i];
+	}
+}
+
+static Aggregates *cubeAnswers(Cube *cube){
+	Aggregates *agg;
+	int i,j,k;
+
+	createAggregates(&agg, CUBE_QUERIES);
+	if (cube->yearNum > 0){
+		growTally(agg, cube->firstYear, cube->firstYear+cube->yearNum-1);
+	}
+
+	for (i=0;i<=cube->yearNum;i++){
+		for (j=0;j<CUBE_MONTHS;j++){
+			for (k=0;k<CUBE_LOCS;k++){
+				/*Query 1 only counts known years and months*/
+				if (i < cube->yearNum && j < CUBE_MONTHS-1){
+					agg->tally[TALLY(i,j,0)] += cube->coll[CUBE_COLL(i,j,k)];
+				}
+				if (k < CUBE_LOCS-1){
+					agg->locs[k] += cube->coll[CUBE_COLL(i,j,k)];
+				}
+			}
+			for (k=0;k<CUBE_GENDERS;k++){
+				if (i < cube->yearNum && j < CUBE_MONTHS-1){
+					agg->tally[TALLY(i,j,1)] += cube->deaths[CUBE_DEATHS(i,j,k)];
+				}
+			}
+			agg->killed[0] += cube->deaths[CUBE_DEATHS(i,j,0)];
+			agg->killed[1] += cube->deaths[CUBE_DEATHS(i,j,1)];
+		}
+	}
+
+	for (i=CUBE_VEHS-1;i>0;i--){
+		if (cube->vehCount[i] > 0){
+			agg->mostVeh.total = i;
+			agg->mostVeh.date = cube->vehFirst[i];
+			agg->mostVeh.record = cube->vehRecord[i];
+			break;
+		}
+	}
+
+	return agg;
+}
+
+static int cubeFilter(int *queries, int queryNum, int **rest){
+	int i,restNum = 0;
+
+	*rest = malloc(sizeof(int)*(queryNum+1));
+	for (i=0;i<queryNum;i++){
+		if (!useCube || queries[i] < 1 || queries[i] > 5 || !(CUBE_QUERIES & 1<<queries[i])){
+			(*rest)[restNum++] = queries[i];
+		}
+	}
+	return restNum;
+}
+
+static void scanDataset(Dataset *dataset, Aggregates *agg){
+	foldCollisions(dataset, 0, dataset->colNum, agg);
+}
+
+static void dropRecords(Dataset *dataset, int count){
+	int i, left = recCount(dataset)-count;
+
+	memmove(dataset->year, dataset->year+count, sizeof(short)*left);
+	memmove(dataset->month, dataset->month+count, left);
+	memmove(dataset->day, dataset->day+count, left);
+	memmove(dataset->location, dataset->location+count, left);
+	memmove(dataset->gender, dataset->gender+count, left);
+	memmove(dataset->vehYear, dataset->vehYear+count, sizeof(short)*left);
+	memmove(dataset->vehNum, dataset->vehNum+count, left);
+	memmove(dataset->vehID, dataset->vehID+count, left);
+
+	/*Deaths are shifted a bit at a time since count
+	need not be a multiple of 8*/
+	for (i=0;i<left;i++){
+		if (DIED(dataset,i+count)){
+			dataset->death[i/8] |= 1 << (i%8);
+		}
+		else{
+			dataset->death[i/8] &= ~(1 << (i%8));
+		}
+	}
+	memset(dataset->death+(left+7)/8, 0, (dataset->recCap+7)/8-(left+7)/8);
+	if (left%8 != 0){
+		dataset->death[left/8] &= (1 << (left%8))-1;
+	}
+
+	/*Keep only the collisions that start in the records left*/
+	for (i=0;i<colCount(dataset) && dataset->collisionIndex[i] < count;i++);
+	memmove(dataset->collisionIndex, dataset->collisionIndex+i, sizeof(int)*(colCount(dataset)-i));
+	dataset->colNum -= i;
+	for (i=0;i<colCount(dataset);i++){
+		dataset->collisionIndex[i] -= count;
+	}
+	dataset->recNum = left;
+	dataset->firstRecord += count;
+}
+
+static bool streamDataset(FILE *file, long startPos, long readLength, Aggregates *agg){
+	Dataset *dataset = NULL;
+	int i,readCount,count;
+	char *block, prevLine[SIZE_RECORD+SIZE_EOL];
+	double start;
 
-	/*Go to provided address in file*/
 	if (fseek(file,startPos,SEEK_SET) == -1){
-		return NULL;
+		return false;
+	}
+	readCount = (readLength)/(SIZE_RECORD+SIZE_EOL);
+
+	/*Room for one chunk plus the collision carried over from the last*/
+	createDataset(&dataset,2*CHUNK_RECORDS);
+	dataset->firstRecord = RECORD_AT(startPos);
+	block = malloc(CHUNK_RECORDS*(SIZE_RECORD+SIZE_EOL));
+
+	for (i=0; i<readCount; i+=count){
+		count = readCount-i < CHUNK_RECORDS ? readCount-i : CHUNK_RECORDS;
+		start = profStart(PROF_PARSE);
+		fread((void*)block,SIZE_RECORD+SIZE_EOL,count,file);
+
+		addBlock(dataset, block, count, i > 0 ? prevLine : NULL, RECORD_AT(startPos)+i);
+		memcpy(prevLine, block+(count-1)*(SIZE_RECORD+SIZE_EOL), SIZE_RECORD+SIZE_EOL);
+		profEnd(PROF_PARSE, start);
+		profCount((long)count*(SIZE_RECORD+SIZE_EOL), count);
+
+		/*The last collision may continue into the next chunk*/
+		foldCollisions(dataset, 0, colCount(dataset)-1, agg);
+		dropRecords(dataset, dataset->collisionIndex[colCount(dataset)-1]);
+	}
+	if (colCount(dataset) > 0){
+		foldCollisions(dataset, 0, colCount(dataset), agg);
 	}
+	freeDataset(dataset);
+	free(block);
 
-	/*Calculate number of reads based on length provided*/
-	readCount = (readLength)/(SIZE_RECORD+SIZE_EOL);
+	return true;
+}
+
+static bool aggregatePartition(FILE *file, long startPos, long readLength, Aggregates *agg){
+	Dataset *dataset;
+
+	if (streamMode && binary == NULL){
+		return streamDataset(file, startPos, readLength, agg);
+	}
+	if ( (dataset = loadPartition(file, startPos, readLength)) == NULL){
+		return false;
+	}
+	scanDataset(dataset, agg);
+	freeDataset(dataset);
+
+	return true;
+}
+
+static Dataset *loadPartition(FILE *file, long startPos, long readLength){
+	Dataset *dataset;
+	double start = profStart(PROF_PARSE);
+
+	if (binary != NULL){
+		dataset = mapBinary(fileno(file), startPos, readLength);
+	}
+	else{
+		dataset = loadDataset(file, startPos, readLength);
+	}
+	profEnd(PROF_PARSE, start);
+
+	/*Converted files are read a column at a time*/
+	if (dataset != NULL){
+		profCount(binary != NULL ? recCount(dataset)*(long)(2*sizeof(short)+6) : readLength, recCount(dataset));
+	}
+	return dataset;
+}
+
+static void freeAggregates(Aggregates *agg){
+	freeCube(agg->cube);
+	freeArena(agg->arena);
+}
+
+static void mergeAggregates(Aggregates *agg, Aggregates *next){
+	int i;
+
+	addTally(agg, next->firstYear, next->yearNum, next->tally);
+	agg->killed[0] += next->killed[0];
+	agg->killed[1] += next->killed[1];
+
+	/*The earliest collision keeps ties like a single scan would,
+	partitions handed out as chunks need not arrive in order*/
+	if (next->mostVeh.total > agg->mostVeh.total
+		|| (next->mostVeh.total == agg->mostVeh.total && next->mostVeh.record < agg->mostVeh.record)){
+		agg->mostVeh = next->mostVeh;
+	}
+	agg->wrecks.newVehiclesInvolved += next->wrecks.newVehiclesInvolved;
+	agg->wrecks.vehicleAgeTotal += next->wrecks.vehicleAgeTotal;
+	agg->wrecks.vehiclesInvolved += next->wrecks.vehiclesInvolved;
+	for (i=0;i<13;i++){ agg->locs[i] += next->locs[i]; }
 
-	/*Read line from data file provided*/
-	for(i=0; i<readCount; i++){
+	agg->recNum += next->recNum;
+	agg->colNum += next->colNum;
 
-		/*Store previous line for later collision comparison
-		 unless its the first line being read*/
-		if (i > 0){
-			strcpy(prevLine,line);
+	if (agg->cube != NULL && next->cube != NULL){
+		mergeCube(agg->cube, next->cube);
+	}
+	if (agg->adhocNum == next->adhocNum){
+		for (i=0;i<agg->adhocNum;i++){
+			mergeCells(&agg->adhoc[i], agg->cells[i], next->cells[i]);
 		}
-		/*Set collision to one on first read*/
-		else{ dataset->colNum = 1; }
+	}
+}
 
-		/*Read next line of record data*/
-		fread((void*)line,1,SIZE_RECORD+SIZE_EOL,file);
-		line[SIZE_RECORD] = '\0';
+static long *splitPartition(FILE *file, long startPos, long readLength, int parts){
+	long *split = malloc(sizeof(long)*(parts+1));
+	char prevLine[SIZE_RECORD+SIZE_EOL], curLine[SIZE_RECORD+SIZE_EOL];
+	long pos, recNum, endPos = startPos+readLength;
+	int i, low, high;
+
+	split[0] = startPos;
+	split[parts] = endPos;
+	recNum = readLength/(SIZE_RECORD+SIZE_EOL);
+
+	for (i=1;i<parts;i++){
+		/*Converted partitions are already counted in collisions*/
+		if (binary != NULL){
+			split[i] = startPos + readLength*i/parts;
+			continue;
+		}
 
-		record = getRecord(line);
-		addRecord(dataset,record);
+		pos = startPos + recNum*i/parts*(SIZE_RECORD+SIZE_EOL);
+		if (pos <= split[i-1]){
+			pos = split[i-1]+(SIZE_RECORD+SIZE_EOL);
+		}
 
-		/*Compare previous and current line read for same collision
-		unless its the first line being read*/
-		if (i > 0){
-			
-			if (diffCol(prevLine,line)){
-				/*If not part of the same collision than create new index*/
-				dataset->colNum++;
-				addIndex(dataset, recCount(dataset));
+		if (sidecar != NULL){
+			/*First collision starting at or after the guess*/
+			low = 0;
+			high = sidecar->header.colNum;
+			while (low < high){
+				if (sidecar->starts[(low+high)/2] < RECORD_AT(pos)){ low = (low+high)/2+1; }
+				else{ high = (low+high)/2; }
 			}
+			pos = low < sidecar->header.colNum ? SIZE_HEADER+SIZE_EOL+(long)sidecar->starts[low]*(SIZE_RECORD+SIZE_EOL) : endPos;
 		}
-		else{
-			addIndex(dataset,1);
+		else if (pos < endPos){
+			/*Move forward until a record starts a collision*/
+			fseek(file,pos-(SIZE_RECORD+SIZE_EOL),SEEK_SET);
+			fread((void*)prevLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file);
+			fread((void*)curLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file);
+			while (pos < endPos && !diffCol(prevLine,curLine)){
+				pos += SIZE_RECORD+SIZE_EOL;
+				memcpy(prevLine,curLine,SIZE_RECORD+SIZE_EOL);
+				fread((void*)curLine,sizeof(char),SIZE_RECORD+SIZE_EOL,file);
+			}
 		}
-	} 
-	
-	return dataset;
+		split[i] = pos < endPos ? pos : endPos;
+	}
+
+	return split;
 }
 
-static int readLength(int workerNum, int workerCount, int position[], int fileSize){
-	/*Get length of partition*/
-	if (workerNum != (workerCount-1)){
-    	return position[workerNum+1]-position[workerNum]; 
-	}		
+static void *threadJob(void *job){
+	ThreadJob *part = job;
+	FILE *file;
+
+	/*Each thread reads through its own stream*/
+	if ( (file = fopen(part->fileName,"r")) == NULL){
+		part->read = false;
+		return NULL;
+	}
+	if (part->agg != NULL){
+		part->read = aggregatePartition(file, part->startPos, part->readLength, part->agg);
+	}
 	else{
-		return fileSize-position[workerNum];
-	}		
+		part->dataset = loadPartition(file, part->startPos, part->readLength);
+		part->read = part->dataset != NULL;
+	}
+	fclose(file);
+
+	return NULL;
 }
 
-WorstMonth *findMax(int ***arr){
-	int i,j,index=0,max=0;
-	int maxF=0,indexF=0,maxFAll=0,maxAllF=0,maxAll=0;
-	int indexYear=0,indexMonth=0;
-	int months[12][2];
-	WorstMonth *worst = malloc(sizeof(WorstMonth));
+static ThreadJob *runThreads(char *fileName, FILE *file, long startPos, long readLength, Aggregates *agg){
+	ThreadJob *jobs;
+	long *split;
+	int i;
 
-	for (i=0;i<12;i++){
-		months[i][0] = 0;
-		months[i][1] = 0;
-	}
-	
-	for (j=0;j<14;j++){
-		max = 0;
-		maxF = 0;
-		for (i=0;i<12;i++){
-			/*Check for worst non fatal injury month*/
-			if (arr[j][i][0] > max){
-				worst->nonFatal[j].month = i+1;
-				worst->nonFatal[j].year = j+1999;
-				max = arr[j][i][0];
+	split = splitPartition(file, startPos, readLength, threadNum);
+	jobs = malloc(sizeof(ThreadJob)*threadNum);
+
+	for (i=0;i<threadNum;i++){
+		jobs[i].fileName = fileName;
+		jobs[i].startPos = split[i];
+		jobs[i].readLength = split[i+1]-split[i];
+		jobs[i].read = true;
+		jobs[i].agg = NULL;
+		jobs[i].dataset = NULL;
+		if (agg != NULL){
+			createAggregates(&jobs[i].agg, agg->queries);
+			if (agg->cube != NULL){
+				createCube(&jobs[i].agg->cube);
 			}
-			/*Check for worst fatal injury month*/
-			if (arr[j][i][1] > maxF){
-				worst->fatal[j].month = i+1;
-				worst->fatal[j].year = j+1999;
-				maxF = arr[j][i][1];
-			}	
-			/*Total all months*/
-			months[i][0] += arr[j][i][0];
-			months[i][1] += arr[j][i][1];
+			addAdhoc(jobs[i].agg, agg->adhoc, agg->adhocNum);
+		}
+
+		if (jobs[i].readLength > 0 && pthread_create(&jobs[i].thread, NULL, threadJob, &jobs[i]) != 0){
+			/*Fall back to reading the part on this thread*/
+			threadJob(&jobs[i]);
+			jobs[i].readLength = 0;
+		}
+	}
+	for (i=0;i<threadNum;i++){
+		if (jobs[i].readLength > 0){
+			pthread_join(jobs[i].thread, NULL);
 		}
 	}
+	free(split);
 
-	/*Find worst month total*/
-	max = maxF = 0;
-	for (i=0;i<12;i++){
-		if (months[i][0] > max){
-			max = months[i][0];
-			index = i;
+	return jobs;
+}
+
+static bool threadPartition(char *fileName, FILE *file, long startPos, long readLength, Aggregates *agg){
+	ThreadJob *jobs;
+	int i;
+	bool read = true;
+
+	if (threadNum <= 1){
+		return aggregatePartition(file, startPos, readLength, agg);
+	}
+	jobs = runThreads(fileName, file, startPos, readLength, agg);
+
+	/*Merge in partition order so ties resolve as in one scan*/
+	for (i=0;i<threadNum;i++){
+		read = read && jobs[i].read;
+		mergeAggregates(agg, jobs[i].agg);
+		freeAggregates(jobs[i].agg);
+	}
+	free(jobs);
+
+	return read;
+}
+
+static Dataset **residentPartition(char *fileName, FILE *file, long startPos, long readLength, int *datasetNum){
+	Dataset **datasets = malloc(sizeof(Dataset*)*threadNum);
+	ThreadJob *jobs;
+	int i;
+
+	*datasetNum = 0;
+	if (threadNum <= 1){
+		if ( (datasets[0] = loadPartition(file, startPos, readLength)) != NULL){
+			*datasetNum = 1;
 		}
-		if (months[i][1] > maxF){
-			maxF = months[i][1];
-			indexF = i;
+		return datasets;
+	}
+	jobs = runThreads(fileName, file, startPos, readLength, NULL);
+
+	for (i=0;i<threadNum;i++){
+		if (jobs[i].dataset != NULL){
+			datasets[(*datasetNum)++] = jobs[i].dataset;
 		}
 	}
-	worst->total.month = index+1;
-	worst->totalF.month = indexF+1;	
+	free(jobs);
 
-	return worst;
+	return datasets;
 }
 
-int *genderKilled(Dataset *dataset){
-	int i, men=0, women=0,*genderKilled;
-	
-	genderKilled = malloc(sizeof(int)*2);
+static int readRequest(int **queries, GroupQuery **adhoc, int *adhocNum){
+	char line[256], *next, *end;
+	int queryNum = 0;
 
-	for (i=0;i<dataset->recNum;i++){
-		if (dataset->records[i]->gender == 'M'
-			&& dataset->records[i]->death == true){
-			
-			men++;
+	*adhoc = NULL;
+	*adhocNum = 0;
+	if (fgets(line,sizeof(line),stdin) == NULL){
+		return -1;
+	}
+	*queries = malloc(sizeof(int)*(strlen(line)/2+1));
+
+	/*A group query is asked on its own line*/
+	for (next=line; *next == ' ' || *next == '\t'; next++);
+	if (*next == 'g'){
+		*adhoc = malloc(sizeof(GroupQuery));
+		if (parseGroupQuery(next+1, *adhoc)){
+			*adhocNum = 1;
 		}
-		if (dataset->records[i]->gender == 'F'
-			&& dataset->records[i]->death == true){
-			
-			women++;
+		else{
+			printf("Error: Could not parse group query.\n");
+		}
+		return 0;
+	}
+
+	/*Query numbers are separated by spaces or commas*/
+	for (next=line; *next != '\0'; next=end){
+		(*queries)[queryNum] = strtol(next,&end,10);
+		if (end == next){
+			end++;
+		}
+		else{
+			queryNum++;
+		}
+	}
+
+	return queryNum;
+}
+
+int W;
+PI_PROCESS **worker;
+PI_CHANNEL **toWorker;
+PI_CHANNEL **fromWorker;
+PI_BUNDLE *toAllWorkers;
+PI_BUNDLE *fromAllWorkers;
+PI_CHANNEL **chunkRequest;
+PI_BUNDLE *allChunkRequests;
+PI_CHANNEL **toParent;
+
+static void scheduleChunks(int chunkNum){
+	int i,done,asker,next = 0;
+
+	/*Every worker asks once per chunk and once more to find out
+	there are none left. Requests have their own channels since a
+	worker that is done sends its results while others still ask*/
+	for (i=0;i<chunkNum+W;i++){
+		PROFILE(PROF_SELECT, done = PI_Select(allChunkRequests));
+		PROFILE(PROF_READ, PI_Read(chunkRequest[done],"%d",&asker));
+
+		#ifdef DEBUG
+		printf("PI_Main(Master): Worker %d asked for a chunk, sending chunk %d.\n",asker+1,next < chunkNum ? next : -1);
+		#endif
+
+		PROFILE(PROF_WRITE, PI_Write(toWorker[done],"%d",next < chunkNum ? next : -1));
+		if (next < chunkNum){
+			next++;
 		}
 	}
-	genderKilled[0] = men;
-	genderKilled[1] = women;
+}
+
+static Dataset *collectiveDataset(char *fileName, long startPos, long readLength){
+	Dataset *dataset = NULL;
+	MPI_File handle;
+	MPI_Datatype line;
+	MPI_Status status;
+	char *buffer;
+	int read = 0, readCount = readLength/(SIZE_RECORD+SIZE_EOL);
+	double start = profStart(PROF_PARSE);
+
+	if (MPI_File_open(MPI_COMM_WORLD, fileName, MPI_MODE_RDONLY, MPI_INFO_NULL, &handle) != MPI_SUCCESS){
+		return NULL;
+	}
+
+	/*Every rank takes part in the read so the library can
+	combine the requests, the master asks for nothing. Whole
+	lines are counted so partitions over 2GB fit the count*/
+	MPI_Type_contiguous(SIZE_RECORD+SIZE_EOL, MPI_CHAR, &line);
+	MPI_Type_commit(&line);
+	buffer = malloc(readLength > 0 ? readLength : 1);
+	if (MPI_File_read_at_all(handle, (MPI_Offset)startPos, buffer, readCount, line, &status) == MPI_SUCCESS){
+		MPI_Get_count(&status, line, &read);
+	}
+	MPI_Type_free(&line);
+	MPI_File_close(&handle);
+
+	if (readLength > 0 && read == readCount){
+		dataset = bufferDataset(buffer, startPos, readLength);
+		profCount(readLength, recCount(dataset));
+	}
+	free(buffer);
+	profEnd(PROF_PARSE, start);
 
-	return genderKilled;
+	return dataset;
 }
 
-MostVehicles *mostVehicles(Dataset *dataset){
-	MostVehicles *mostVeh = malloc(sizeof(MostVehicles));
-	int i,index;
+static int packAggregates(Aggregates *agg, long long **packed){
+	int i,n = 0,cellNum = 0;
+	long long *out;
 
-	mostVeh->total = 0;	
+	for (i=0;i<agg->adhocNum;i++){
+		cellNum += groupCells(&agg->adhoc[i]);
+	}
+	out = malloc(sizeof(long long)*(PACKED_AGGREGATES+TALLY(agg->yearNum,0,0)+cellNum));
+
+	*packed = out;
+	out[n++] = agg->recNum;
+	out[n++] = agg->colNum;
+	out[n++] = agg->killed[0];
+	out[n++] = agg->killed[1];
+	out[n++] = agg->mostVeh.total;
+	out[n++] = agg->mostVeh.date.year;
+	out[n++] = agg->mostVeh.date.month;
+	out[n++] = agg->mostVeh.date.day;
+	out[n++] = agg->mostVeh.record;
+	out[n++] = agg->wrecks.newVehiclesInvolved;
+	out[n++] = agg->wrecks.vehicleAgeTotal;
+	out[n++] = agg->wrecks.vehiclesInvolved;
+	for (i=0;i<13;i++){ out[n++] = agg->locs[i]; }
+
+	/*The tally and group query tables go last since their
+	lengths vary*/
+	out[n++] = agg->firstYear;
+	out[n++] = agg->yearNum;
+	for (i=0;i<TALLY(agg->yearNum,0,0);i++){ out[n++] = agg->tally[i]; }
+	for (i=0;i<agg->adhocNum;i++){
+		memcpy(out+n, agg->cells[i], sizeof(long long)*groupCells(&agg->adhoc[i]));
+		n += groupCells(&agg->adhoc[i]);
+	}
 
-	for (i=0;i<dataset->colNum;i++){
-		index = dataset->collisionIndex[i];	
-		
-		if (dataset->records[index]->vehNum > mostVeh->total){
-			mostVeh->total = dataset->records[index]->vehNum;
-			mostVeh->date.year = dataset->records[index]->date.year;
-			mostVeh->date.month = dataset->records[index]->date.month;
-			mostVeh->date.day = dataset->records[index]->date.day;
-		}	
+	return n;
+}
+
+static void unpackAggregates(Aggregates *agg, long long *packed){
+	int i,n = 0,firstYear,yearNum;
+
+	agg->recNum = packed[n++];
+	agg->colNum = packed[n++];
+	agg->killed[0] = packed[n++];
+	agg->killed[1] = packed[n++];
+	agg->mostVeh.total = packed[n++];
+	agg->mostVeh.date.year = packed[n++];
+	agg->mostVeh.date.month = packed[n++];
+	agg->mostVeh.date.day = packed[n++];
+	agg->mostVeh.record = packed[n++];
+	agg->wrecks.newVehiclesInvolved = packed[n++];
+	agg->wrecks.vehicleAgeTotal = packed[n++];
+	agg->wrecks.vehiclesInvolved = packed[n++];
+	for (i=0;i<13;i++){ agg->locs[i] = packed[n++]; }
+	firstYear = packed[n++];
+	yearNum = packed[n++];
+	if (yearNum > 0){
+		growTally(agg, firstYear, firstYear+yearNum-1);
+	}
+	for (i=0;i<TALLY(yearNum,0,0);i++){ agg->tally[TALLY(firstYear-agg->firstYear,0,0)+i] += packed[n++]; }
+	for (i=0;i<agg->adhocNum;i++){
+		memcpy(agg->cells[i], packed+n, sizeof(long long)*groupCells(&agg->adhoc[i]));
+		n += groupCells(&agg->adhoc[i]);
 	}
-	return mostVeh;
-	 
 }
 
-NewWreckedCars *countNewWrecks(Dataset *dataset){
-	NewWreckedCars *newWrecks = malloc(sizeof(NewWreckedCars));
-	int i,k,index,j,**idChecked,length;
-	int repeat[2];	
+static int packCube(Cube *cube, int **packed){
+	int i,n = 0;
+	int *out = malloc(sizeof(int)*(PACKED_CUBE+CUBE_COLL(cube->yearNum+1,0,0)+CUBE_DEATHS(cube->yearNum+1,0,0)));
+
+	*packed = out;
+	for (i=0;i<CUBE_VEHS;i++){
+		out[n++] = cube->vehCount[i];
+		out[n++] = cube->vehFirst[i].year;
+		out[n++] = cube->vehFirst[i].month;
+		out[n++] = cube->vehFirst[i].day;
+		out[n++] = cube->vehRecord[i];
+	}
+
+	/*The years go last since their number varies*/
+	out[n++] = cube->firstYear;
+	out[n++] = cube->yearNum;
+	memcpy(out+n, cube->coll, sizeof(int)*CUBE_COLL(cube->yearNum+1,0,0));
+	n += CUBE_COLL(cube->yearNum+1,0,0);
+	memcpy(out+n, cube->deaths, sizeof(int)*CUBE_DEATHS(cube->yearNum+1,0,0));
+	n += CUBE_DEATHS(cube->yearNum+1,0,0);
+
+	return n;
+}
 
-	newWrecks->newVehiclesInvolved = 0;
-	newWrecks->vehicleAgeTotal = 0;
-	newWrecks->vehiclesInvolved = 0;
+static Cube *unpackCube(int *packed){
+	Cube *cube;
+	int i,n = 0;
+
+	createCube(&cube);
+	for (i=0;i<CUBE_VEHS;i++){
+		cube->vehCount[i] = packed[n++];
+		cube->vehFirst[i].year = packed[n++];
+		cube->vehFirst[i].month = packed[n++];
+		cube->vehFirst[i].day = packed[n++];
+		cube->vehRecord[i] = packed[n++];
+	}
+	if (packed[n+1] > 0){
+		growCube(cube, packed[n], packed[n]+packed[n+1]-1);
+	}
+	n += 2;
+	memcpy(cube->coll, packed+n, sizeof(int)*CUBE_COLL(cube->yearNum+1,0,0));
+	n += CUBE_COLL(cube->yearNum+1,0,0);
+	memcpy(cube->deaths, packed+n, sizeof(int)*CUBE_DEATHS(cube->yearNum+1,0,0));
 
-	for (i=0;i<dataset->colNum;i++){
-		index = dataset->collisionIndex[i];	
+	return cube;
+}
 
-		if (i != dataset->colNum-1){
-			length = dataset->collisionIndex[i+1]-index;
+static void reduceTree(int num, Aggregates *agg){
+	Aggregates *child;
+	long long *packed;
+	int step,size;
+
+	/*At each step a worker either takes in the aggregates of the
+	partitions after it or hands its own to the worker before it,
+	so partitions are always merged in file order*/
+	for (step=1;step<W;step<<=1){
+		if (num & step){
+			size = packAggregates(agg, &packed);
+			PROFILE(PROF_WRITE, PI_Write(toParent[num],"%^lld",size,packed));
+			free(packed);
+			return;
 		}
-		else{
-			length = dataset->recNum - dataset->collisionIndex[i];
+		if (num+step < W){
+			PROFILE(PROF_READ, PI_Read(toParent[num+step],"%^lld",&size,&packed));
+			createAggregates(&child, agg->queries);
+			addAdhoc(child, agg->adhoc, agg->adhocNum);
+			unpackAggregates(child, packed);
+			mergeAggregates(agg, child);
+			freeAggregates(child);
+			free(packed);
 		}
-	
-		idChecked = malloc(sizeof(int*)*length);
-		for (j=0;j<length;j++){
-			idChecked[j] = malloc(sizeof(int)*2);
-			idChecked[j][0] =0;
-			idChecked[j][1] = 0;
+	}
+}
+
+static void sendResults(int num, Aggregates *agg, int *queries, int queryNum){
+	long long *packed;
+	int i,size;
+
+	if (treeReduce){
+		/*Only the root of the tree writes to the master*/
+		reduceTree(num, agg);
+		if (num == 0){
+			size = packAggregates(agg, &packed);
+			PROFILE(PROF_WRITE, PI_Write(fromWorker[num],"%^lld",size,packed));
+			free(packed);
 		}
-	
-		for (j=index;j<index+length;j++){
-	
-			/*Check for repeat*/
-			repeat[0] = 0;
-			repeat[1] = 0;
-			for (k=0;k<length;k++){
-				if (dataset->records[j]->vehID == idChecked[k][0]){
-					repeat[0] = true;
-				}
-				if (dataset->records[j]->vehID == idChecked[k][1]){
-					repeat[1] = true;
-				}
-			}		    
-
-		    if ( (dataset->records[j]->vehID != 99) && (dataset->records[j]->vehID > 0)  && !repeat[0] && (dataset->records[j]->vehYear > 0) 
-			    && (dataset->records[j]->vehYear >= dataset->records[j]->date.year)){	
-			    newWrecks->newVehiclesInvolved++;
-				idChecked[j-index][0] = dataset->records[j]->vehID;	
-		    }
-		    if ( (dataset->records[j]->vehID != 99) && (dataset->records[j]->vehID > 0)  && !repeat[1] && (dataset->records[j]->vehYear > 1000)) {
-			    newWrecks->vehicleAgeTotal += dataset->records[j]->date.year - dataset->records[j]->vehYear + 1;
-				newWrecks->vehiclesInvolved ++;
-				idChecked[j-index][1] = dataset->records[j]->vehID;
-		    }	
+	}
+	else{
+		/*Write amount of records to master*/
+		PROFILE(PROF_WRITE, PI_Write(fromWorker[num], "%d %d", agg->recNum, agg->colNum));	
+
+		for (i=0;i<queryNum;i++){
+			/*Write the result of each query in the order requested*/
+			switch(queries[i]){
+				case 1:
+					/*Write amount of collisions found each month
+					as one array ordered by year, month then fatal*/
+					PROFILE(PROF_WRITE, PI_Write(fromWorker[num], "%d %^d",agg->firstYear,TALLY(agg->yearNum,0,0),agg->tally));
+					break;
+				case 2:
+					PROFILE(PROF_WRITE, PI_Write(fromWorker[num], "%d %d",agg->killed[0],agg->killed[1]));
+					break;
+				case 3:
+					PROFILE(PROF_WRITE, PI_Write(fromWorker[num],"%d %d %d %d %d",agg->mostVeh.total,agg->mostVeh.date.year,agg->mostVeh.date.month,agg->mostVeh.date.day,agg->mostVeh.record));
+					break;
+				case 4:
+					PROFILE(PROF_WRITE, PI_Write(fromWorker[num],"%d %d %d",agg->wrecks.newVehiclesInvolved,agg->wrecks.vehicleAgeTotal,agg->wrecks.vehiclesInvolved));
+					break;
+				case 5:
+					PROFILE(PROF_WRITE, PI_Write(fromWorker[num],"%^d",13,agg->locs));
+					break;
+			}
+		}	
+
+		/*Group query tables follow the query results*/
+		for (i=0;i<agg->adhocNum;i++){
+			PROFILE(PROF_WRITE, PI_Write(fromWorker[num],"%^lld",groupCells(&agg->adhoc[i]),agg->cells[i]));
 		}
-		
 	}
+}
+
+static Cube *gatherCubes(void){
+	Cube *cube, *next;
+	int i,size,*packed;
 
-	return newWrecks;
+	createCube(&cube);
+	for (i=0;i<W;i++){
+		PROFILE(PROF_READ, PI_Read(fromWorker[i],"%^d",&size,&packed));
+		next = unpackCube(packed);
+		mergeCube(cube, next);
+		freeCube(next);
+		free(packed);
+	}
+	return cube;
 }
 
-int *countLocations(Dataset *dataset){
-	int *locs = malloc(sizeof(int)*13);	
-	int i;
-	int index;
+static Aggregates *gatherResults(int queries, GroupQuery *adhoc, int adhocNum, long recReal){
+	Aggregates *local = NULL;
+	long long *packed;
+	int i,done,size;
+	int recFound,colFound;
+	long recTotal = 0, colTotal = 0;
+
+	/*The root of the tree sends the aggregates of every worker*/
+	if (treeReduce){
+		PROFILE(PROF_READ, PI_Read(fromWorker[0],"%^lld",&size,&packed));
+		createAggregates(&local, queries);
+		addAdhoc(local, adhoc, adhocNum);
+		unpackAggregates(local, packed);
+		free(packed);
+		recTotal = local->recNum;
+		colTotal = local->colNum;
+	}
 
-	for (i=0;i<13;i++){ locs[i] = 0; }
-	
-	for (i=0;i<dataset->colNum;i++){
-		index = dataset->collisionIndex[i];
+	/*Get number of records found by all workers
+	and compare to number of records found by main*/
+	for (i=0;i<W && !treeReduce;i++){
+
+		/*Query results follow the counts on each channel,
+		so the counts are read from each worker in turn*/
+		done = i;
 		
-		if (dataset->records[index]->location >= 0){
-			locs[dataset->records[index]->location]++;
-		}	
+		#ifdef DEBUG
+		printf("PI_Main(Master): Calling PI_Read on fromWorker[%d] to get record and collision numbers found by worker %d. \n"
+			,done,done +1);
+		#endif
+
+		PROFILE(PROF_READ, PI_Read(fromWorker[done],"%d %d", &recFound,&colFound));
+
+		#ifdef DEBUG
+		printf("PI_Main(Master): Received a count of %d records and %d collision from worker %d through fromWorker[%d](CHANNEL)\n",recFound,colFound,done+1,done);
+		#endif
+
+		colTotal += colFound;
+		recTotal += recFound;
 	}
 
-	return locs;
-}
+	#ifdef DEBUG	
+	printf("PI_Main(Master): Calculated %ld records present in file based on file size.\n",recReal);
+	printf("PI_Main(Master): Received a total of %ld records and %ld collisions from %d workers.\n",recTotal,colTotal,W);
+	#endif
 
-int W;
-PI_PROCESS **worker;
-PI_CHANNEL **toWorker;
-PI_CHANNEL **fromWorker;
-PI_BUNDLE *toAllWorkers;
-PI_BUNDLE *fromAllWorkers;
+	if (recReal != recTotal){
+		PI_Abort(0,"Record number reported by workers is invalid",__FILE__,__LINE__);
+	}
+
+	return local;
+}
 
 int workerJob(int num, void *fileName){
-	MostVehicles *mostVeh;
-	NewWreckedCars *wrecks;
-	FILE *file;
-	Dataset *dataset;
-	int i,j,k,queryNum,curQuery;
-	int numPos,*position,length;
-	int ***colls;
-	int *killed;
-	int *locs;
+	Aggregates *agg;
+	Dataset *dataset, **datasets = NULL;
+	FILE *file = NULL;
+	GroupQuery *adhoc;
+	int i,queryNum,*queries,adhocNum;
+	int numPos,chunk,datasetNum = 0;
+	int size,*packed;
+	long *position,length;
 	
 	#ifdef DEBUG
 	printf("Worker(%d): Created and received filename: %s as 2nd argument\n"
 		,num+1,(char*)fileName);
 	#endif
 
-	PI_Read(toWorker[num],"%^d",&numPos, &position);
+	PROFILE(PROF_READ, PI_Read(toWorker[num],"%^ld",&numPos, &position));
 	
 	#ifdef DEBUG
 	printf("Worker(%d): Called PI_Read on toWorker[%d](Channel) and received file index from master.\n",num+1,num);
 	#endif
 
-	file = fopen( (char*)fileName, "r");
-
-	length = readLength(num,W,position,fileSize(file));		
-	/*Get data in workers partition*/
-	if ( (dataset = partDataset(file, position[num], length)) == NULL){
-		printf("Error: Worker %d could not parse dataset.\n",num);
+	/*The master builds the sidecar before sending positions*/
+	if (useIndex && binary == NULL){
+		sidecar = openIndex((char*)fileName);
 	}
-	fclose(file);
 
-	#ifdef DEBUG
-	printf("Worker(%d): Finished reading file, data needs to be sent to master(PI_Main). Calling PI_Write on fromWorker[%d](Channel) with %d records and %d collisions\n"
-		,num+1,num,dataset->recNum,dataset->colNum);
-	#endif
+	/*Positions end with the end of the file, or the number of 
+	collisions of a converted file*/
+	numPos--;
+	length = readLength(num,W,position,position[numPos]);
+
+	if (serveMode){
+		/*Keep the partition loaded and scan it again for every
+		request until the master sends an empty one*/
+		if (collectiveRead){
+			datasets = malloc(sizeof(Dataset*));
+			if ( (datasets[0] = collectiveDataset((char*)fileName, position[num], length)) != NULL){
+				datasetNum = 1;
+			}
+		}
+		else if ( (file = openFile( (char*)fileName)) != NULL){
+			datasets = residentPartition((char*)fileName, file, position[num], length, &datasetNum);
+			fclose(file);
+		}
+		else{
+			printf("Error: Worker %d could not open %s.\n",num,(char*)fileName);
+		}
+
+		/*The cube is built once, right after loading*/
+		if (useCube){
+			createAggregates(&agg, 0);
+			createCube(&agg->cube);
+			for (i=0;i<datasetNum;i++){
+				scanDataset(datasets[i], agg);
+			}
+			size = packCube(agg->cube, &packed);
+			PROFILE(PROF_WRITE, PI_Write(fromWorker[num],"%^d",size,packed));
+			free(packed);
+			freeAggregates(agg);
+		}
+
+		PROFILE(PROF_READ, PI_Read(toWorker[num],"%^d",&queryNum,&queries));
+		PROFILE(PROF_READ, PI_Read(toWorker[num],"%^d",&adhocNum,&adhoc));
+		adhocNum /= GROUP_INTS;
+		while (queryNum > 0 || adhocNum > 0){
+			createAggregates(&agg, queryMask(queries,queryNum));
+			addAdhoc(agg, adhoc, adhocNum);
+			for (i=0;i<datasetNum;i++){
+				scanDataset(datasets[i], agg);
+			}
+			sendResults(num, agg, queries, queryNum);
+			freeAggregates(agg);
+			free(queries);
+			free(adhoc);
+
+			PROFILE(PROF_READ, PI_Read(toWorker[num],"%^d",&queryNum,&queries));
+			PROFILE(PROF_READ, PI_Read(toWorker[num],"%^d",&adhocNum,&adhoc));
+			adhocNum /= GROUP_INTS;
+		}
 
-	/*Write amount of records to master*/
-	PI_Write(fromWorker[num], "%d %d", dataset->recNum, dataset->colNum);	
+		/*Each partition goes in one call*/
+		for (i=0;i<datasetNum;i++){
+			freeDataset(datasets[i]);
+		}
+		free(datasets);
+		sendProfile(num);
+		return 0;
+	}
 
-	/*Get the first query and the number of queries*/
-	PI_Read(toWorker[num],"%d %d",&queryNum,&curQuery);
+	/*Get every query up front so they can share one scan,
+	the cube answers some of them in the same pass*/
+	PROFILE(PROF_READ, PI_Read(toWorker[num],"%^d",&queryNum,&queries));
+	PROFILE(PROF_READ, PI_Read(toWorker[num],"%^d",&adhocNum,&adhoc));
+	if (useCube){
+		createAggregates(&agg, queryMask(queries,queryNum) & ~CUBE_QUERIES);
+		createCube(&agg->cube);
+	}
+	else{
+		createAggregates(&agg, queryMask(queries,queryNum));
+	}
+	addAdhoc(agg, adhoc, adhocNum/GROUP_INTS);
 
-	for (i=0;i<queryNum;i++){
-		/*Perform certain calculation based on query*/
-		switch(curQuery){
-			case 1:
-				/*Write amount of collisions found each month*/
-				colls = collEachMonth(dataset);
-				for (k=0;k<14;k++){
-					for (j=0;j<12;j++){
-						PI_Write(fromWorker[num], "%d %d %^d",k+1,j+1,2,colls[k][j]);
-					}
-				}	
-				break;
-			case 2:
-				killed = genderKilled(dataset);
-				PI_Write(fromWorker[num], "%d %d",killed[0],killed[1]);
-				break;
-			case 3:
-				mostVeh = mostVehicles(dataset);
-				PI_Write(fromWorker[num],"%d %d %d %d",mostVeh->total,mostVeh->date.year,mostVeh->date.month,mostVeh->date.day);
-				break;
-			case 4:
-				wrecks = countNewWrecks(dataset);
-				PI_Write(fromWorker[num],"%d %d %d",wrecks->newVehiclesInvolved,wrecks->vehicleAgeTotal,wrecks->vehiclesInvolved);
-				break;
-			case 5:
-				locs = countLocations(dataset);
-				PI_Write(fromWorker[num],"%^d",13,locs);
-				break;
+	if (collectiveRead){
+		/*The whole partition is read in one collective call*/
+		if ( (dataset = collectiveDataset((char*)fileName, position[num], length)) != NULL){
+			scanDataset(dataset, agg);
+			freeDataset(dataset);
 		}
-		/*Get the next query unless last iteration*/
-		if (i!= queryNum-1){
-			PI_Read(toWorker[num],"%d %d",&queryNum,&curQuery);
+		else if (length > 0){
+			printf("Error: Worker %d could not read its partition.\n",num);
 		}
-	}	
+	}
+	else if ( (file = openFile( (char*)fileName)) == NULL){
+		printf("Error: Worker %d could not open %s.\n",num,(char*)fileName);
+	}
+	else if (chunksPerWorker > 0){
+		/*Keep asking the master for chunks until none are left,
+		the positions received are the start of every chunk*/
+		PROFILE(PROF_WRITE, PI_Write(chunkRequest[num],"%d",num));
+		PROFILE(PROF_READ, PI_Read(toWorker[num],"%d",&chunk));
+		while (chunk >= 0){
+			length = readLength(chunk,numPos,position,position[numPos]);
+			if (!threadPartition((char*)fileName, file, position[chunk], length, agg)){
+				printf("Error: Worker %d could not parse chunk %d.\n",num,chunk);
+			}
+			PROFILE(PROF_WRITE, PI_Write(chunkRequest[num],"%d",num));
+			PROFILE(PROF_READ, PI_Read(toWorker[num],"%d",&chunk));
+		}
+	}
+	else{
+		/*Aggregate data in workers partition*/
+		if (!threadPartition((char*)fileName, file, position[num], length, agg)){
+			printf("Error: Worker %d could not parse dataset.\n",num);
+		}
+	}
+	if (file != NULL){
+		fclose(file);
+	}
+
+	#ifdef DEBUG
+	printf("Worker(%d): Finished reading file, data needs to be sent to master(PI_Main). Calling PI_Write on fromWorker[%d](Channel) with %d records and %d collisions\n"
+		,num+1,num,agg->recNum,agg->colNum);
+	#endif
+
+	/*Send the cube before the results it did not answer*/
+	if (useCube){
+		size = packCube(agg->cube, &packed);
+		PROFILE(PROF_WRITE, PI_Write(fromWorker[num],"%^d",size,packed));
+		free(packed);
+		queryNum = cubeFilter(queries, queryNum, &queries);
+	}
+	sendResults(num, agg, queries, queryNum);
+	freeAggregates(agg);
+	sendProfile(num);
 
 	#ifdef DEBUG
 	printf("Worker(%d) exiting.\n",num+1);
@@ -795,139 +3860,122 @@ int workerJob(int num, void *fileName){
 	return 0; 
 }
 
-void processQueryOne(Dataset *dataset){
-	int ***colAmount;
+void processQueryOne(Aggregates *local){
+	Aggregates *colAmount = local;
 	int *colls;
-	int j,k,done,month,year,size;
+	int i,j,size,firstYear;
 	WorstMonth *worst;
 
-	/*Initialize array*/
-	colAmount = malloc(sizeof(int**)*14);
-	for (j=0;j<14;j++){
-		colAmount[j] = malloc(sizeof(int*)*12);
-		for (k=0;k<12;k++){
-			colAmount[j][k] = malloc(sizeof(int)*2);
-			colAmount[j][k][0] = 0;
-			colAmount[j][k][1] = 0;
-		}
-	}
-
-	/*Collect each workers findings for each month*/
-	if (W>=1){
-		for (j=0;j<W*14*12;j++){
-			done = PI_Select(fromAllWorkers);
-			PI_Read(fromWorker[done],"%d %d %^d",&year,&month, &size, &colls);
-
-			colAmount[year-1][month-1][0] += colls[0];
-			colAmount[year-1][month-1][1] += colls[1];	
+	/*Collect each workers findings for each month, workers 
+	may have seen different years*/
+	if (local == NULL){
+		createAggregates(&colAmount, 1<<1);
 
+		/*Workers send every result without waiting, so each worker's
+		results are read in turn to keep queries from interleaving*/
+		for (i=0;i<W;i++){
+			PROFILE(PROF_READ, PI_Read(fromWorker[i],"%d %^d",&firstYear,&size,&colls));
+			addTally(colAmount, firstYear, size/TALLY(1,0,0), colls);
+			free(colls);
 		}
 	}
-	else{
-		colAmount = collEachMonth(dataset);
-	}
 		
 	/*Print results*/
 	worst = findMax(colAmount);
-	for (j=0;j<14;j++){
-		fprintf(stdout,"$Q1,%d,%d,%d\n",worst->nonFatal[j].year,worst->nonFatal[j].month,worst->fatal[j].month);	
+	for (j=0;j<worst->yearNum;j++){
+		fprintf(answerOut,"$Q1,%d,%d,%d\n",worst->nonFatal[j].year,worst->nonFatal[j].month,worst->fatal[j].month);	
+	}
+	fprintf(answerOut,"$Q1,9999,%d,%d\n",worst->total.month,worst->totalF.month);
+	free(worst);
+	if (local == NULL){
+		freeAggregates(colAmount);
 	}
-	fprintf(stdout,"$Q1,9999,%d,%d\n",worst->total.month,worst->totalF.month);
 }
-void processQueryTwo(Dataset *dataset){
+void processQueryTwo(Aggregates *local){
 	int done,i,men,women;
 	int menTotal=0, womenTotal=0;
-	int *gender;
 
-	if (W >= 1){	
+	if (local == NULL){
 		for (i=0;i<W;i++){
-			done = PI_Select(fromAllWorkers);
-			PI_Read(fromWorker[done],"%d %d",&men,&women);
+			done = i;
+			PROFILE(PROF_READ, PI_Read(fromWorker[done],"%d %d",&men,&women));
 			menTotal += men;
 			womenTotal += women;	
 		}
 	}
 	else{
-		gender = genderKilled(dataset);	
-		menTotal = gender[0];
-		womenTotal = gender[1];	
+		menTotal = local->killed[0];
+		womenTotal = local->killed[1];	
 	}
-	fprintf(stdout,"$Q2,%d,%d,%.2f,%.2f\n",menTotal,womenTotal
+	fprintf(answerOut,"$Q2,%d,%d,%.2f,%.2f\n",menTotal,womenTotal
 		,(double)menTotal/(menTotal+womenTotal),(double)womenTotal/(menTotal+womenTotal));
 }
 
-void processQueryThree(Dataset *dataset){
-	MostVehicles **mostVeh;
-	int i,max=0,index,done;
+void processQueryThree(Aggregates *local){
+	MostVehicles *mostVeh = NULL, *best;
+	int i,done;
 
-	mostVeh = malloc(sizeof(MostVehicles*)*W);
-	for (i=0;i<W;i++){
-		mostVeh[i] = malloc(sizeof(MostVehicles));
-	}
-	
-	if (W >= 1){
+	if (local == NULL){
+		mostVeh = calloc(W,sizeof(MostVehicles));
 		for (i=0;i<W;i++){
-			done = PI_Select(fromAllWorkers);
-			PI_Read(fromWorker[done],"%d %d %d %d",&mostVeh[i]->total,&mostVeh[i]->date.year,&mostVeh[i]->date.month,&mostVeh[i]->date.day);
+			done = i;
+			PROFILE(PROF_READ, PI_Read(fromWorker[done],"%d %d %d %d %d",&mostVeh[i].total,&mostVeh[i].date.year,&mostVeh[i].date.month,&mostVeh[i].date.day,&mostVeh[i].record));
 		}
-		for (i=0;i<W;i++){
-			if (mostVeh[i]->total > max){
-				index = i;
-				max = mostVeh[i]->total;
+
+		/*Ties go to the collision earliest in the file*/
+		best = &mostVeh[0];
+		for (i=1;i<W;i++){
+			if (mostVeh[i].total > best->total
+				|| (mostVeh[i].total == best->total && mostVeh[i].record < best->record)){
+				best = &mostVeh[i];
 			}
 		}
 	}
 	else{
-		mostVeh[0] = mostVehicles(dataset);
-		index = 0;
+		best = &local->mostVeh;
 	}
 
-	fprintf(stdout,"$Q3,%d,%d,%d,%d\n",mostVeh[index]->total,mostVeh[index]->date.year,mostVeh[index]->date.month,mostVeh[index]->date.day);
+	fprintf(answerOut,"$Q3,%d,%d,%d,%d\n",best->total,best->date.year,best->date.month,best->date.day);
+	free(mostVeh);
 }
 
-void processQueryFour(Dataset *dataset){
-	NewWreckedCars *wrecks = malloc(sizeof(NewWreckedCars));
+void processQueryFour(Aggregates *local){
+	NewWreckedCars total = {0,0,0}, *wrecks = &total;
 	int i,done,crashes,veh,age;
 
-	wrecks->newVehiclesInvolved = 0;
-	wrecks->vehicleAgeTotal = 0;
-	wrecks->vehiclesInvolved = 0;
-
-	if (W >= 1){
+	if (local == NULL){
 		for (i=0;i<W;i++){
-			done = PI_Select(fromAllWorkers);
-			PI_Read(fromWorker[done],"%d %d %d",&crashes,&age,&veh);
+			done = i;
+			PROFILE(PROF_READ, PI_Read(fromWorker[done],"%d %d %d",&crashes,&age,&veh));
 			wrecks->newVehiclesInvolved += crashes;
 			wrecks->vehicleAgeTotal += age; 
 			wrecks->vehiclesInvolved += veh;
 		}
 	}
 	else{
-		wrecks = countNewWrecks(dataset);
+		wrecks = &local->wrecks;
 	}
-	fprintf(stdout,"$Q4,%.0f,%.1f\n",(double)wrecks->newVehiclesInvolved/14,(double)wrecks->vehicleAgeTotal/wrecks->vehiclesInvolved);
+	fprintf(answerOut,"$Q4,%.0f,%.1f\n",(double)wrecks->newVehiclesInvolved/14,(double)wrecks->vehicleAgeTotal/wrecks->vehiclesInvolved);
 }
 
-void processQueryFive(Dataset *dataset){
+void processQueryFive(Aggregates *local){
 	int i,j,done,*locs,size;
-	int *locsTotal;
-	int max=0,index;
+	int total[13] = {0}, *locsTotal = total;
+	int max=0,index=0;
 
-	locsTotal = malloc(sizeof(int)*13);
-	for (i=0;i<13;i++){ locsTotal[i] = 0; }
-	
-	if (W >= 1){
+	if (local == NULL){
 		for (i=0;i<W;i++){
-			done = PI_Select(fromAllWorkers);
-			PI_Read(fromWorker[done],"%^d",&size,&locs);
+			done = i;
+			PROFILE(PROF_READ, PI_Read(fromWorker[done],"%^d",&size,&locs));
 			
 			for (j=0;j<13;j++){
 				locsTotal[j] += locs[j];
 			}
+			free(locs);
 		}
 	}
 	else{
-		locsTotal = countLocations(dataset);
+		locsTotal = local->locs;
 	}
 
 	/*Get most likely place*/
@@ -937,28 +3985,506 @@ void processQueryFive(Dataset *dataset){
 			index = i;
 		}
 	}
-	fprintf(stdout,"$Q5,%d",index);
+	fprintf(answerOut,"$Q5,%d",index);
 	for (i=1;i<13;i++){
-		fprintf(stdout,",%d",locsTotal[i]);
+		fprintf(answerOut,",%d",locsTotal[i]);
+	}
+	fprintf(answerOut,",%d\n",locsTotal[0]);
+}
+
+static void answerQueries(int *queries, int queryNum, Aggregates *local){
+	Aggregates *from;
+	int i;
+
+	for (i=0;i<queryNum;i++){
+
+		/*Queries the cube answers never reach the workers*/
+		from = local;
+		if (cubeResults != NULL && queries[i] >= 1 && queries[i] <= 5 && (CUBE_QUERIES & 1<<queries[i])){
+			from = cubeResults;
+		}
+
+		switch(queries[i]){
+			case 1:
+				processQueryOne(from);
+				break;
+			case 2:
+				processQueryTwo(from);
+				//Who is more likely to be killed in a collision? Men or women?
+				break;
+			case 3:
+				processQueryThree(from);
+				//Most number of vehicles crashed on which day?
+				break;
+			case 4:
+				processQueryFour(from);
+				//How many people wreck their new car, average vehicle age
+				break;
+			case 5:
+				processQueryFive(from);
+				//Where is the most likely place to have a collision?
+					break;
+		}	
+	}
+}
+
+static void answerAdhoc(GroupQuery *adhoc, int adhocNum, Aggregates *local){
+	long long *cells,*next;
+	int i,j,size;
+
+	for (i=0;i<adhocNum;i++){
+		if (local != NULL){
+			printGroupQuery(i+1, &adhoc[i], local->cells[i]);
+			continue;
+		}
+
+		/*Tables follow the query results on each channel*/
+		cells = malloc(sizeof(long long)*groupCells(&adhoc[i]));
+		clearCells(&adhoc[i], cells);
+		for (j=0;j<W;j++){
+			PROFILE(PROF_READ, PI_Read(fromWorker[j],"%^lld",&size,&next));
+			mergeCells(&adhoc[i], cells, next);
+			free(next);
+		}
+		printGroupQuery(i+1, &adhoc[i], cells);
+		free(cells);
+	}
+}
+
+static void startProfile(void){
+	memset(&profile, 0, sizeof(Profile));
+	#ifdef USE_MPE
+	int i;
+
+	/*Pilot starts MPE itself when asked to log*/
+	if (!MPE_Initialized_logging()){
+		MPE_Init_log();
+	}
+	for (i=0;i<PROF_PHASES;i++){
+		MPE_Log_get_state_eventIDs(&profileEvents[i][0], &profileEvents[i][1]);
+		MPE_Describe_state(profileEvents[i][0], profileEvents[i][1], (char*)phaseNames[i], i < PROF_WRITE ? "green" : "red");
+	}
+	#endif
+}
+
+static double profStart(int phase){
+	if (!profileMode){
+		return 0;
+	}
+	#ifdef USE_MPE
+	pthread_mutex_lock(&profileLock);
+	MPE_Log_event(profileEvents[phase][0], 0, NULL);
+	pthread_mutex_unlock(&profileLock);
+	#else
+	(void)phase;
+	#endif
+	return MPI_Wtime();
+}
+
+static void profEnd(int phase, double start){
+	double end;
+
+	if (!profileMode){
+		return;
+	}
+	end = MPI_Wtime();
+
+	pthread_mutex_lock(&profileLock);
+	profile.seconds[phase] += end-start;
+	profile.calls[phase]++;
+	#ifdef USE_MPE
+	MPE_Log_event(profileEvents[phase][1], 0, NULL);
+	#endif
+	pthread_mutex_unlock(&profileLock);
+}
+
+static FILE *openFile(char *fileName){
+	FILE *file;
+
+	PROFILE(PROF_OPEN, file = fopen(fileName,"r"));
+	return file;
+}
+
+static void profCount(long bytes, long records){
+	if (!profileMode){
+		return;
+	}
+	pthread_mutex_lock(&profileLock);
+	profile.bytes += bytes;
+	profile.records += records;
+	pthread_mutex_unlock(&profileLock);
+}
+
+static void sendProfile(int num){
+	long counts[PROF_PHASES+2];
+
+	if (!profileMode){
+		return;
+	}
+	memcpy(counts, profile.calls, sizeof(long)*PROF_PHASES);
+	counts[PROF_PHASES] = profile.bytes;
+	counts[PROF_PHASES+1] = profile.records;
+	PI_Write(fromWorker[num],"%^lf %^ld",PROF_PHASES,profile.seconds,PROF_PHASES+2,counts);
+
+	#ifdef USE_MPE
+	MPE_Finish_log((char*)"bang");
+	#endif
+}
+
+static void printProfile(int process, Profile *report){
+	int i;
+
+	for (i=0;i<PROF_PHASES;i++){
+		if (report->calls[i] > 0){
+			fprintf(stdout,"$PROF,%d,%s,%ld,%.6f\n",process,phaseNames[i],report->calls[i],report->seconds[i]);
+		}
+	}
+	fprintf(stdout,"$PROF,%d,bytes,%ld\n",process,report->bytes);
+	fprintf(stdout,"$PROF,%d,records,%ld\n",process,report->records);
+}
+
+static void gatherProfiles(void){
+	Profile *reports = malloc(sizeof(Profile)*(W > 0 ? W : 1));
+	double *seconds, least, most, total;
+	long *counts;
+	int i,j,size;
+
+	printProfile(0, &profile);
+
+	/*Profiles follow everything else each worker sends*/
+	for (i=0;i<W;i++){
+		PI_Read(fromWorker[i],"%^lf %^ld",&size,&seconds,&size,&counts);
+		memcpy(reports[i].seconds, seconds, sizeof(double)*PROF_PHASES);
+		memcpy(reports[i].calls, counts, sizeof(long)*PROF_PHASES);
+		reports[i].bytes = counts[PROF_PHASES];
+		reports[i].records = counts[PROF_PHASES+1];
+		free(seconds);
+		free(counts);
+		printProfile(i+1, &reports[i]);
+	}
+
+	/*How far the slowest worker is behind the average shows
+	imbalance between partitions*/
+	for (j=0;j<PROF_PHASES && W > 0;j++){
+		least = most = reports[0].seconds[j];
+		total = 0;
+		for (i=0;i<W;i++){
+			least = reports[i].seconds[j] < least ? reports[i].seconds[j] : least;
+			most = reports[i].seconds[j] > most ? reports[i].seconds[j] : most;
+			total += reports[i].seconds[j];
+		}
+		if (total > 0){
+			fprintf(stdout,"$PROF,spread,%s,%.6f,%.6f,%.2f\n",phaseNames[j],least,most,most/(total/W));
+		}
+	}
+	free(reports);
+
+	#ifdef USE_MPE
+	MPE_Finish_log((char*)"bang");
+	#endif
+}
+
+static void beginAnswers(void){
+	if (verifyMode){
+		answerOut = open_memstream(&answerText, &answerSize);
+	}
+}
+
+static char *serialAnswers(char *fileName, int *queries, int queryNum, GroupQuery *adhoc, int adhocNum){
+	FILE *file, *out;
+	Dataset *dataset;
+	Aggregates *agg;
+	Aggregates *savedCube = cubeResults;
+	CollisionIndex *savedIndex = sidecar;
+	bool savedProfile = profileMode;
+	void (*savedDecode)(Dataset *dataset, const char *records, int count) = decodeRecords;
+	char *text = NULL;
+	size_t size = 0;
+
+	if ( (file = fopen(fileName,"r")) == NULL){
+		return NULL;
+	}
+
+	/*Collisions are found by comparing records and every
+	answer comes from the one scan*/
+	cubeResults = NULL;
+	sidecar = NULL;
+	profileMode = false;
+	if (binary != NULL){
+		dataset = mapBinary(fileno(file), 0, binary->colNum);
+	}
+	else{
+		decodeRecords = decodeScalar;
+		dataset = partDataset(file, SIZE_HEADER+SIZE_EOL, fileSize(file)-SIZE_HEADER-SIZE_EOL);
+		decodeRecords = savedDecode;
+	}
+	fclose(file);
+
+	createAggregates(&agg, queryMask(queries,queryNum));
+	addAdhoc(agg, adhoc, adhocNum);
+	scanDataset(dataset, agg);
+
+	out = answerOut;
+	answerOut = open_memstream(&text, &size);
+	answerQueries(queries,queryNum,agg);
+	answerAdhoc(adhoc,adhocNum,agg);
+	fclose(answerOut);
+	answerOut = out;
+
+	freeAggregates(agg);
+	freeDataset(dataset);
+	cubeResults = savedCube;
+	sidecar = savedIndex;
+	profileMode = savedProfile;
+
+	return text;
+}
+
+static void endAnswers(char *fileName, int *queries, int queryNum, GroupQuery *adhoc, int adhocNum){
+	char *serial, *line, *serialLine;
+	int lines = 0;
+
+	if (!verifyMode){
+		return;
+	}
+	fclose(answerOut);
+	answerOut = stdout;
+	fputs(answerText, stdout);
+
+	if ( (serial = serialAnswers(fileName,queries,queryNum,adhoc,adhocNum)) == NULL){
+		PI_Abort(0,"Could not read the file to verify answers",__FILE__,__LINE__);
+	}
+
+	/*Report the first line that differs*/
+	line = answerText;
+	serialLine = serial;
+	while (*line != '\0' || *serialLine != '\0'){
+		if (strcspn(line,"\n") != strcspn(serialLine,"\n") || strncmp(line,serialLine,strcspn(line,"\n")) != 0){
+			printf("Error: Answer %.*s differs from serial answer %.*s\n",(int)strcspn(line,"\n"),line
+				,(int)strcspn(serialLine,"\n"),serialLine);
+			fflush(stdout);
+			PI_Abort(0,"Answers differ from a serial pass over the file",__FILE__,__LINE__);
+		}
+		line += strcspn(line,"\n");
+		line += (*line == '\n');
+		serialLine += strcspn(serialLine,"\n");
+		serialLine += (*serialLine == '\n');
+		lines++;
+	}
+	fprintf(stdout,"$VERIFY,%d,%d\n",W,lines);
+
+	free(serial);
+	free(answerText);
+	answerText = NULL;
+}
+
+static void printBench(char *phase, int workers, long records, double seconds){
+	fprintf(stdout,"$BENCH,%s,%d,%ld,%.6f,%.0f\n",phase,workers,records,seconds
+		,seconds > 0 ? records/seconds : 0.0);
+}
+
+static void runBench(char *fileName){
+	FILE *file;
+	Dataset *dataset;
+	Aggregates *agg;
+	uint64_t bounds[CHUNK_RECORDS/64];
+	char *buffer, phase[16];
+	long records, length, found = 0;
+	int i, j, count, mode, savedMode = readMode;
+	double start;
+
+	if ( (file = fopen(fileName,"r")) == NULL){
+		return;
+	}
+
+	if (binary != NULL){
+		start = MPI_Wtime();
+		dataset = mapBinary(fileno(file), 0, binary->colNum);
+		printBench("ingest_binary",1,binary->recNum,MPI_Wtime()-start);
+	}
+	else{
+		length = fileSize(file)-SIZE_HEADER-SIZE_EOL;
+		records = length/(SIZE_RECORD+SIZE_EOL);
+
+		/*Each reader loads the whole file, the last one loaded
+		is kept for the queries*/
+		dataset = NULL;
+		for (mode=READ_STDIO; mode<=READ_MMAP; mode++){
+			if (dataset != NULL){
+				freeDataset(dataset);
+			}
+			readMode = mode;
+			start = MPI_Wtime();
+			dataset = loadDataset(file, SIZE_HEADER+SIZE_EOL, length);
+			printBench(mode == READ_STDIO ? "ingest_stdio" : "ingest_mmap",1,records,MPI_Wtime()-start);
+		}
+		readMode = savedMode;
+
+		/*Boundaries are found in records already in memory*/
+		buffer = malloc(length > 0 ? length : 1);
+		fseek(file, SIZE_HEADER+SIZE_EOL, SEEK_SET);
+		records = fread(buffer, SIZE_RECORD+SIZE_EOL, records, file);
+		start = MPI_Wtime();
+		for (i=0;i<records;i+=count){
+			count = records-i < CHUNK_RECORDS ? records-i : CHUNK_RECORDS;
+			markBoundaries(buffer+(long)i*(SIZE_RECORD+SIZE_EOL), count
+				, i > 0 ? buffer+(long)(i-1)*(SIZE_RECORD+SIZE_EOL) : NULL, bounds);
+			for (j=0;j<(count+63)/64;j++){
+				found += __builtin_popcountll(bounds[j]);
+			}
+		}
+		printBench("boundaries",1,records,MPI_Wtime()-start);
+		free(buffer);
+
+		if (sidecar == NULL && found != colCount(dataset)){
+			printf("Error: Found %ld collision boundaries but loaded %d collisions.\n",found,colCount(dataset));
+		}
+	}
+
+	/*Each query scans the whole dataset on its own*/
+	for (i=1;i<=5;i++){
+		createAggregates(&agg, 1<<i);
+		start = MPI_Wtime();
+		scanDataset(dataset, agg);
+		sprintf(phase,"query%d",i);
+		printBench(phase,1,recCount(dataset),MPI_Wtime()-start);
+		freeAggregates(agg);
 	}
-	fprintf(stdout,",%d\n",locsTotal[0]);
+	freeDataset(dataset);
+	fclose(file);
 }
 
 int main(int argc,char **argv){
 	FILE *file;
-	WorstMonth *worst;
-	Dataset *dataset=NULL;
-	int *colls,year,month,size;
-	int *position,length[W];
-	int N,i,j,k,done,queryNum;
-	int recFound, recTotal,recReal,colFound,colTotal;
-	int colAmount[14][12][2];	
+	Aggregates *local=NULL;
+	Dataset **datasets;
+	Cube *cube;
+	long *position,startPos,length,recReal;
+	int i,queryNum,*queries,partNum,datasetNum,restNum,*rest;
+	int opt,adhocNum = 0;
+	GroupQuery *adhoc = NULL;
+	char *convertName = NULL;
+	double start,phaseStart;
 
 	W = PI_Configure(&argc,&argv);	
+
+	/*Options precede the file name, every process parses them
+	before the workers are started*/
+	while ( (opt = getopt(argc,argv,"r:sc:it:d:Rmqkg:bpv")) != -1){
+		switch(opt){
+			case 'r':
+				if (strcmp(optarg,"stdio") == 0){
+					readMode = READ_STDIO;
+				}
+				else if (strcmp(optarg,"mmap") == 0){
+					readMode = READ_MMAP;
+				}
+				else{
+					printf("Error: Unknown reader %s, expected stdio or mmap.\n",optarg);
+					return(EXIT_FAILURE);
+				}
+				break;
+			case 's':
+				streamMode = true;
+				break;
+			case 'c':
+				convertName = optarg;
+				break;
+			case 'i':
+				useIndex = true;
+				break;
+			case 't':
+				if ( (threadNum = strtol(optarg,NULL,10)) < 1){
+					printf("Error: Thread count must be at least 1.\n");
+					return(EXIT_FAILURE);
+				}
+				break;
+			case 'd':
+				if ( (chunksPerWorker = strtol(optarg,NULL,10)) < 1){
+					printf("Error: Chunks per worker must be at least 1.\n");
+					return(EXIT_FAILURE);
+				}
+				break;
+			case 'R':
+				treeReduce = true;
+				break;
+			case 'm':
+				collectiveRead = true;
+				break;
+			case 'q':
+				serveMode = true;
+				break;
+			case 'k':
+				useCube = true;
+				break;
+			case 'b':
+				benchMode = true;
+				break;
+			case 'p':
+				profileMode = true;
+				break;
+			case 'v':
+				verifyMode = true;
+				break;
+			case 'g':
+				adhoc = realloc(adhoc,sizeof(GroupQuery)*(adhocNum+1));
+				if (!parseGroupQuery(optarg,&adhoc[adhocNum++])){
+					printf("Error: Could not parse group query %s.\n",optarg);
+					return(EXIT_FAILURE);
+				}
+				break;
+			default:
+				printf("Usage: %s [-r stdio|mmap] [-s] [-i] [-t threads] [-d chunks] [-R] [-m] [-q] [-k] [-g group] [-b] [-p] [-v] [-c converted] file query...\n",argv[0]);
+				return(EXIT_FAILURE);
+		}
+	}
+	argv += optind-1;
+	argc -= optind-1;
+
+	/*The whole run is timed on the master*/
+	start = MPI_Wtime();
+	answerOut = stdout;
+	if (profileMode){
+		startProfile();
+	}
+
+	/*Use the vector decoder if this CPU supports it*/
+	decodeRecords = decodeScalar;
+	#ifdef HAVE_AVX2
+	if (__builtin_cpu_supports("avx2")){
+		decodeRecords = decodeAvx2;
+	}
+	#endif
+
 	worker = malloc(sizeof(PI_PROCESS*)*(W-1));
 	toWorker = malloc(sizeof(PI_CHANNEL*)*(W-1));
 	fromWorker = malloc(sizeof(PI_CHANNEL*)*(W-1));
 
+	queryNum = argc-2;
+	queries = malloc(sizeof(int)*(queryNum+1));
+	for (i=0;i<queryNum;i++){
+		queries[i] = strtol(argv[i+2],NULL,10);
+	}
+
+	/*Every process checks whether the file was converted*/
+	if ( (file = fopen(argv[1],"r")) != NULL){
+		binary = readBinaryHeader(file);
+		fclose(file);
+	}
+
+	/*A server keeps its partitions loaded, so it neither streams
+	them nor takes them a chunk at a time*/
+	if (serveMode){
+		streamMode = false;
+		chunksPerWorker = 0;
+	}
+
+	/*Collective reads cover csv files split once between workers,
+	every process decides this the same way*/
+	if (binary != NULL || chunksPerWorker > 0){
+		collectiveRead = false;
+	}
+
 	W = W-1;
 	if (W >= 1){		
 		/*Create each worker and channels*/
@@ -972,107 +4498,233 @@ int main(int argc,char **argv){
 		fromAllWorkers = PI_CreateBundle(PI_SELECT,fromWorker,W);
 		toAllWorkers = PI_CreateBundle(PI_BROADCAST, toWorker,W);
 
+		/*Each worker hands its aggregates up the tree through
+		a channel to the worker before it*/
+		if (treeReduce){
+			toParent = malloc(sizeof(PI_CHANNEL*)*W);
+			for (i=1;i<W;i++){
+				toParent[i] = PI_CreateChannel(worker[i],worker[i & (i-1)]);
+			}
+		}
+
+		/*Workers ask for chunks through their own channels*/
+		if (chunksPerWorker > 0){
+			chunkRequest = malloc(sizeof(PI_CHANNEL*)*W);
+			for (i=0;i<W;i++){
+				chunkRequest[i] = PI_CreateChannel(worker[i],PI_MAIN);
+			}
+			allChunkRequests = PI_CreateBundle(PI_SELECT,chunkRequest,W);
+		}
+
 		PI_StartAll();
 
 		/*Open file and count records*/
-		if ( (file = fopen(argv[1],"r")) == NULL){
+		if ( (file = openFile(argv[1])) == NULL){
 			printf("Error: File not provided or could not be opened. Exiting.");
 			return(EXIT_FAILURE);
 		}
 
-		recReal = (fileSize(file)-SIZE_HEADER-SIZE_EOL)/(SIZE_RECORD+SIZE_EOL);
-		position = startPositions(file,W);
+		if (convertName != NULL && !convertFile(file,convertName,W)){
+			printf("Error: Could not convert file to %s.\n",convertName);
+		}
+
+		/*Split the file into a chunk per worker, or into many
+		smaller chunks handed out as workers finish them*/
+		partNum = chunksPerWorker > 0 ? W*chunksPerWorker : W;
+
+		phaseStart = profStart(PROF_POSITIONS);
+		if (binary != NULL){
+			recReal = binary->recNum;
+			position = binaryPositions(file,partNum);
+		}
+		else if (useIndex){
+			recReal = (fileSize(file)-SIZE_HEADER-SIZE_EOL)/(SIZE_RECORD+SIZE_EOL);
+			if ( (sidecar = openIndex(argv[1])) == NULL){
+				sidecar = buildIndex(file,argv[1]);
+			}
+			position = indexPositions(partNum);
+		}
+		else{
+			recReal = (fileSize(file)-SIZE_HEADER-SIZE_EOL)/(SIZE_RECORD+SIZE_EOL);
+			position = startPositions(file,partNum);
+		}
+
+		/*Workers are sent where the file ends so none of them
+		has to find its size*/
+		position = realloc(position,sizeof(long)*(partNum+1));
+		position[partNum] = (binary != NULL) ? binary->colNum : fileSize(file);
 		fclose(file);
+		profEnd(PROF_POSITIONS, phaseStart);
 
 		#ifdef DEBUG
 		printf("PI_Main(Master): Broadcasting(PI_Broadcast) array of file indexes to toAllWorkers(BUNDLE).\n");
 		#endif 
 
-		PI_Broadcast(toAllWorkers,"%^d",W,position);
-
-		recTotal = colTotal = 0;
+		PROFILE(PROF_BROADCAST, PI_Broadcast(toAllWorkers,"%^ld",partNum+1,position));
 
-		/*Get number of records found by all workers
-		and compare to number of records found by main*/
-		for (i=0;i<W;i++){
+		if (serveMode){
+			/*Take part in the collective read without reading*/
+			if (collectiveRead){
+				collectiveDataset(argv[1],0,0);
+			}
+			if (useCube){
+				cube = gatherCubes();
+				cubeResults = cubeAnswers(cube);
+				freeCube(cube);
+			}
 
-			#ifdef DEBUGs
-			printf("PI_Main(Master): Calling PI_Select on fromAllWorkers(CHANNEL), waiting a for worker to write.\n");
-			#endif
-			
-			done = PI_Select(fromAllWorkers);
-			
-			#ifdef DEBUG
-			printf("PI_Main(Master): PI_Select on fromAllWorkers(CHANNEL) returned %d, calling PI_Read on fromWorker[%d] to get record and collision numbers found by worker %d. \n"
-				,done,done,done +1);
-			#endif
+			/*Queries on the command line are the first request,
+			then each line of stdin is one until it ends. Only
+			queries the cube cannot answer are sent to workers*/
+			do{
+				local = NULL;
+				beginAnswers();
+				if ( (restNum = cubeFilter(queries,queryNum,&rest)) > 0 || adhocNum > 0){
+					PROFILE(PROF_BROADCAST, PI_Broadcast(toAllWorkers,"%^d",restNum,rest));
+					PROFILE(PROF_BROADCAST, PI_Broadcast(toAllWorkers,"%^d",adhocNum*GROUP_INTS,(int*)adhoc));
+					local = gatherResults(queryMask(rest,restNum),adhoc,adhocNum,recReal);
+					answerQueries(queries,queryNum,local);
+					answerAdhoc(adhoc,adhocNum,local);
+				}
+				else{
+					answerQueries(queries,queryNum,local);
+				}
+				endAnswers(argv[1],queries,queryNum,adhoc,adhocNum);
+				if (local != NULL){
+					freeAggregates(local);
+				}
+				fflush(stdout);
+				free(queries);
+				free(rest);
+				free(adhoc);
+			}while ( (queryNum = readRequest(&queries,&adhoc,&adhocNum)) >= 0);
+
+			/*An empty request lets the workers exit*/
+			PROFILE(PROF_BROADCAST, PI_Broadcast(toAllWorkers,"%^d",0,&queryNum));
+			PROFILE(PROF_BROADCAST, PI_Broadcast(toAllWorkers,"%^d",0,&queryNum));
+		}
+		else{
+			/*Send all query requests to workers at once
+			so they can be answered while reading*/
+			PROFILE(PROF_BROADCAST, PI_Broadcast(toAllWorkers,"%^d",queryNum,queries));
+			PROFILE(PROF_BROADCAST, PI_Broadcast(toAllWorkers,"%^d",adhocNum*GROUP_INTS,(int*)adhoc));
 
-			PI_Read(fromWorker[done],"%d %d", &recFound,&colFound);
+			if (chunksPerWorker > 0){
+				scheduleChunks(partNum);
+			}
 
-			#ifdef DEBUG
-			printf("PI_Main(Master): Received a count of %d records and %d collision from worker %d through fromWorker[%d](CHANNEL)\n",recFound,colFound,done+1,done);
-			#endif
+			/*Take part in the collective read without reading*/
+			if (collectiveRead){
+				collectiveDataset(argv[1],0,0);
+			}
+			if (useCube){
+				cube = gatherCubes();
+				cubeResults = cubeAnswers(cube);
+				freeCube(cube);
+			}
 
-			colTotal += colFound;
-			recTotal += recFound;
-		}
-		if (recReal != recTotal){
-			PI_Abort(0,"Record number reported by workers is invalid",__FILE__,__LINE__);
+			restNum = cubeFilter(queries,queryNum,&rest);
+			local = gatherResults(queryMask(rest,restNum),adhoc,adhocNum,recReal);
+			beginAnswers();
+			answerQueries(queries,queryNum,local);
+			answerAdhoc(adhoc,adhocNum,local);
+			endAnswers(argv[1],queries,queryNum,adhoc,adhocNum);
 		}
 	}
 	else{	
 		/*Open file and count records*/
-		if ( (file = fopen(argv[1],"r")) == NULL){
+		if ( (file = openFile(argv[1])) == NULL){
 			printf("Error: File not provided or could not be opened. Exiting.");
 			return(EXIT_FAILURE);
 		}
-		recReal = (fileSize(file)-SIZE_HEADER-SIZE_EOL)/(SIZE_RECORD+SIZE_EOL);	
-		dataset = partDataset(file,SIZE_HEADER+SIZE_EOL,fileSize(file)-SIZE_HEADER-SIZE_EOL);
-		recTotal = dataset->recNum;
-		colTotal = dataset->colNum;
-	}
-
-	for (i=1;i<argc-1;i++){
+		if (convertName != NULL && !convertFile(file,convertName,1)){
+			printf("Error: Could not convert file to %s.\n",convertName);
+		}
+		recReal = (binary != NULL) ? binary->recNum : countRecords(file);
 
-		/*Send all query requests to workers*/
-		queryNum = strtol(argv[i+1],NULL,10);
-		
-		if (W >= 1){
-			PI_Broadcast(toAllWorkers,"%d %d",argc-2, queryNum);
+		if (binary != NULL){
+			startPos = 0;
+			length = binary->colNum;
+		}
+		else{
+			phaseStart = profStart(PROF_POSITIONS);
+			if (useIndex && (sidecar = openIndex(argv[1])) == NULL){
+				sidecar = buildIndex(file,argv[1]);
+			}
+			profEnd(PROF_POSITIONS, phaseStart);
+			startPos = SIZE_HEADER+SIZE_EOL;
+			length = fileSize(file)-SIZE_HEADER-SIZE_EOL;
 		}
 
-		switch(queryNum){
-			case 1:
-				processQueryOne(dataset);
-				break;
-			case 2:
-				processQueryTwo(dataset);
-				//Who is more likely to be killed in a collision? Men or women?
-				break;
-			case 3:
-				processQueryThree(dataset);
-				//Most number of vehicles crashed on which day?
-				break;
-			case 4:
-				processQueryFour(dataset);
-				//How many people wreck their new car, average vehicle age
-				break;
-			case 5:
-				processQueryFive(dataset);
-				//Where is the most likely place to have a collision?
-					break;
-		}	
+		if (serveMode){
+			/*Load once and scan again for every request*/
+			datasets = residentPartition(argv[1],file,startPos,length,&datasetNum);
+			fclose(file);
+			if (useCube){
+				createAggregates(&local, 0);
+				createCube(&local->cube);
+				for (i=0;i<datasetNum;i++){
+					scanDataset(datasets[i], local);
+				}
+				cubeResults = cubeAnswers(local->cube);
+				freeAggregates(local);
+			}
+			do{
+				local = NULL;
+				if ( (restNum = cubeFilter(queries,queryNum,&rest)) > 0 || adhocNum > 0){
+					createAggregates(&local, queryMask(rest,restNum));
+					addAdhoc(local, adhoc, adhocNum);
+					for (i=0;i<datasetNum;i++){
+						scanDataset(datasets[i], local);
+					}
+				}
+				beginAnswers();
+				answerQueries(queries,queryNum,local);
+				answerAdhoc(adhoc,adhocNum,local);
+				endAnswers(argv[1],queries,queryNum,adhoc,adhocNum);
+				if (local != NULL){
+					freeAggregates(local);
+				}
+				fflush(stdout);
+				free(queries);
+				free(rest);
+				free(adhoc);
+			}while ( (queryNum = readRequest(&queries,&adhoc,&adhocNum)) >= 0);
+
+			for (i=0;i<datasetNum;i++){
+				freeDataset(datasets[i]);
+			}
+			free(datasets);
+		}
+		else{
+			/*Answer every query in one pass when working alone*/
+			restNum = cubeFilter(queries,queryNum,&rest);
+			createAggregates(&local, queryMask(rest,restNum));
+			addAdhoc(local, adhoc, adhocNum);
+			if (useCube){
+				createCube(&local->cube);
+			}
+			threadPartition(argv[1],file,startPos,length,local);
+			fclose(file);
+			if (useCube){
+				cubeResults = cubeAnswers(local->cube);
+			}
+			beginAnswers();
+			answerQueries(queries,queryNum,local);
+			answerAdhoc(adhoc,adhocNum,local);
+			endAnswers(argv[1],queries,queryNum,adhoc,adhocNum);
+		}
 	}
-	
 
-	#ifdef DEBUG	
-	printf("PI_Main(Master): Calculated %d records present in file based on file size.\n",recReal);
-	printf("PI_Main(Master): Received a total of %d records and %d collisions from %d workers.\n",recTotal,colTotal,W);
-	#endif
-	
-	if (W > 1){
-		PI_StopMain(0);
+	if (profileMode){
+		gatherProfiles();
 	}
+	if (benchMode){
+		printBench("total",W,recReal,MPI_Wtime()-start);
+		runBench(argv[1]);
+	}
+
+	PI_StopMain(0);
 
 	return 0;
 }
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIZE_RECORD 61          //Length of a record
+#define SIZE_HEADER 145         //Lenght of a header
+#define LENGTH_COLL 32			//Characters representing collision level data
+#define MAX_PERSONS 99          //Persons a collision can hold, ids are two digits
+
+#define HEADER "C_YEAR,C_MNTH,C_WDAY,C_HOUR,C_SEV,C_VEHS,C_CONF,C_RCFG,C_WTHR,C_RSUR,C_RALN,C_TRAF,"\
+	"V_ID,V_TYPE,V_YEAR,P_ID,P_SEX,P_AGE,P_PSN,P_ISEV,P_SAFE,P_USER"
+
+typedef struct Options Options;
+typedef struct Options {
+	long rows;                  //Records to write
+	double meanPersons;         //Average persons in a collision
+	int maxPersons;             //Most persons in a collision
+	int firstYear;              //Year of the first collisions
+	int lastYear;               //Year of the last collisions
+	long collisions;            //Most collisions to write, 0 for no limit
+	int unknown;                //Percent chance of an unknown month, hour or vehicle, -1 for the usual rates
+	uint64_t seed;              //Seed of the generator, the same seed gives the same file
+}Options;
+
+uint64_t state;                 //State of the random number generator
+
+/******************HELPER FUNCTION DOCUMENTATION*********************/
+/*********************************************************************
+ * FUNCTION NAME: nextRandom
+ * PURPOSE: Steps the xorshift generator, which gives the same
+ *          sequence on every platform for a seed.
+ * RETURNS: Next 64 bit random number.
+ *********************************************************************/
+static uint64_t nextRandom(void);
+
+/*********************************************************************
+ * FUNCTION NAME: randomBelow
+ * PURPOSE: Picks a random number in a range.
+ * ARGUMENTS: . Number of values in the range starting at 0.
+ * RETURNS: Integer from 0 to one less than the number given.
+ *********************************************************************/
+static int randomBelow(int range);
+
+/*********************************************************************
+ * FUNCTION NAME: personCount
+ * PURPOSE: Picks the number of persons in a collision, each further
+ *          person being added with a fixed chance so the counts
+ *          follow a geometric distribution of the mean requested.
+ * ARGUMENTS: . Options of the file being written.
+ * RETURNS: Number of persons from 1 to the most allowed.
+ *********************************************************************/
+static int personCount(Options *options);
+
+/*********************************************************************
+ * FUNCTION NAME: isUnknown
+ * PURPOSE: Picks whether a field of a record is left unknown.
+ * ARGUMENTS: . Options of the file being written.
+ *            . One in how many of the field are unknown at the usual
+ *              rate.
+ * RETURNS: True if the field is unknown.
+ *********************************************************************/
+static bool isUnknown(Options *options, int usual);
+
+/*********************************************************************
+ * FUNCTION NAME: writeCollision
+ * PURPOSE: Writes the records of one collision.
+ * ARGUMENTS: . Options of the file being written.
+ *            . File to write to.
+ *            . Year of the collision.
+ *            . Number of persons in the collision.
+ *            . Collision level data of the previous collision, which
+ *              the new one must differ from. Updated to the new one.
+ *********************************************************************/
+static void writeCollision(Options *options, FILE *file, int year, int persons, char *previous);
+
+static uint64_t nextRandom(void){
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545F4914F6CDD1DULL;
+}
+
+static int randomBelow(int range){
+	return (int)((nextRandom() >> 33) % (uint64_t)range);
+}
+
+static int personCount(Options *options){
+	int persons = 1;
+	double more = 1.0 - 1.0/options->meanPersons;
+
+	while (persons < options->maxPersons && (nextRandom() >> 11) * (1.0/9007199254740992.0) < more){
+		persons++;
+	}
+	return persons;
+}
+
+static bool isUnknown(Options *options, int usual){
+	if (options->unknown < 0){
+		return randomBelow(usual) == 0;
+	}
+	return randomBelow(100) < options->unknown;
+}
+
+static void writeCollision(Options *options, FILE *file, int year, int persons, char *previous){
+	char line[2*SIZE_RECORD], month[3], hour[3], location[3], vehYear[5];
+	int i, j, vehicles, vehID, vehType, onVehicle[MAX_PERSONS+1] = {0};
+
+	/*Some collisions leave the month, hour or location unknown*/
+	vehicles = 1 + randomBelow(persons < 9 ? persons : 9);
+	if (isUnknown(options,50)){ strcpy(month,"UU"); }
+	else{ sprintf(month,"%02d",1+randomBelow(12)); }
+	if (isUnknown(options,50)){ strcpy(hour,"UU"); }
+	else{ sprintf(hour,"%02d",randomBelow(24)); }
+	switch(randomBelow(16)){
+		case 0: strcpy(location,"QQ"); break;
+		case 1: strcpy(location,"UU"); break;
+		default: sprintf(location,"%02d",1+randomBelow(12)); break;
+	}
+
+	/*Persons are written sorted by vehicle with the unknown vehicle
+	last, otherwise a change of vehicle would start a new collision*/
+	for (i=0;i<persons;i++){
+		onVehicle[isUnknown(options,20) ? 99 : 1+randomBelow(vehicles)]++;
+	}
+
+	i = 0;
+	for (vehID=1;vehID<=MAX_PERSONS;vehID++){
+		if (onVehicle[vehID] == 0){
+			continue;
+		}
+
+		/*Persons in the same vehicle share its type and year*/
+		vehType = 1+randomBelow(23);
+		if (isUnknown(options,20)){ strcpy(vehYear,"UUUU"); }
+		else{ sprintf(vehYear,"%04d",year+1-randomBelow(25)); }
+
+		for (j=0;j<onVehicle[vehID];j++,i++){
+			snprintf(line,sizeof(line),"%04d,%s,%d,%s,%d,%02d,%02d,%s,%d,%d,%d,%02d,%02d,%02d,%s,%02d,%c,%02d,%02d,%d,%02d,%d",
+				year, month, 1+randomBelow(7), hour, 1+randomBelow(2), vehicles, 1+randomBelow(40),
+				location, 1+randomBelow(7), 1+randomBelow(9), 1+randomBelow(6), randomBelow(19),
+				vehID, vehType, vehYear, 1+j, "MFMFMFNU"[randomBelow(8)], randomBelow(99),
+				11+randomBelow(88), 1+randomBelow(3), 1+randomBelow(12), 1+randomBelow(5));
+
+			/*Consecutive collisions must differ in their collision level
+			data or they would be read as one*/
+			if (i == 0 && strncmp(line,previous,LENGTH_COLL) == 0){
+				line[11] = line[11] == '9' ? '0' : line[11]+1;
+			}
+			if (i == 0){
+				memcpy(previous,line,LENGTH_COLL);
+			}
+			else{
+				memcpy(line,previous,LENGTH_COLL);
+			}
+			fprintf(file,"%s\r\n",line);
+		}
+	}
+}
+
+int main(int argc, char **argv){
+	Options options = {1000000, 2.0, MAX_PERSONS, 1999, 2012, 0, -1, 1};
+	char previous[LENGTH_COLL+1] = "";
+	FILE *file;
+	long row = 0, collision = 0;
+	int opt, persons, year;
+
+	while ( (opt = getopt(argc,argv,"n:m:x:y:c:u:s:")) != -1){
+		switch(opt){
+			case 'n':
+				options.rows = strtol(optarg,NULL,10);
+				break;
+			case 'm':
+				options.meanPersons = strtod(optarg,NULL);
+				break;
+			case 'x':
+				options.maxPersons = strtol(optarg,NULL,10);
+				break;
+			case 'y':
+				if (sscanf(optarg,"%d-%d",&options.firstYear,&options.lastYear) != 2){
+					options.firstYear = -1;
+				}
+				break;
+			case 'c':
+				options.collisions = strtol(optarg,NULL,10);
+				break;
+			case 'u':
+				options.unknown = strtol(optarg,NULL,10);
+				break;
+			case 's':
+				options.seed = strtoull(optarg,NULL,10);
+				break;
+			default:
+				options.rows = -1;
+				break;
+		}
+	}
+	if (optind != argc-1 || options.rows < 0 || options.meanPersons < 1.0
+		|| options.maxPersons < 1 || options.maxPersons > MAX_PERSONS
+		|| options.firstYear < 1000 || options.lastYear > 9999 || options.firstYear > options.lastYear
+		|| options.collisions < 0 || options.unknown > 100){
+
+		printf("Usage: %s [-n rows] [-m mean persons] [-x most persons] [-y first-last year] [-c most collisions] [-u percent unknown] [-s seed] file\n",argv[0]);
+		return(EXIT_FAILURE);
+	}
+	if ( (file = fopen(argv[optind],"w")) == NULL){
+		printf("Error: Could not create %s.\n",argv[optind]);
+		return(EXIT_FAILURE);
+	}
+
+	/*A zero seed would leave the generator stuck at zero*/
+	state = options.seed != 0 ? options.seed : 0x9E3779B97F4A7C15ULL;
+	fprintf(file,"%s\r\n",HEADER);
+
+	/*Years rise through the file like in the real extracts. The last
+	collision allowed takes every row left that it can hold*/
+	while (row < options.rows && (options.collisions == 0 || collision < options.collisions)){
+		persons = personCount(&options);
+		if (++collision == options.collisions){
+			persons = options.maxPersons;
+		}
+		if (persons > options.rows-row){
+			persons = options.rows-row;
+		}
+		year = options.firstYear + (int)(row*(options.lastYear-options.firstYear+1)/options.rows);
+		writeCollision(&options, file, year, persons, previous);
+		row += persons;
+	}
+	fclose(file);
+	printf("Wrote %ld records in %ld collisions to %s.\n",row,collision,argv[optind]);
+
+	return 0;
+}